@@ -1,10 +1,14 @@
+import logging
+
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome import core, pins
-from esphome.components import display, spi
+from esphome import automation, core, pins
+from esphome.components import display, sensor, spi
 from esphome.const import (
     CONF_BUSY_PIN,
+    CONF_RAW_DATA_ID,
     CONF_DC_PIN,
+    CONF_FILE,
     CONF_FULL_UPDATE_EVERY,
     CONF_ID,
     CONF_LAMBDA,
@@ -12,12 +16,307 @@ from esphome.const import (
     CONF_PAGES,
     CONF_RESET_DURATION,
     CONF_RESET_PIN,
+    CONF_RESIZE,
+    CONF_TRIGGER_ID,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    ICON_COUNTER,
+    STATE_CLASS_MEASUREMENT,
+    UNIT_BYTES,
+    UNIT_MILLISECOND,
 )
 
 DEPENDENCIES = ["spi"]
+AUTO_LOAD = ["sensor"]
+
+_LOGGER = logging.getLogger(__name__)
+
+CONF_PALETTE = "palette"
+CONF_BLACK = "black"
+CONF_WHITE = "white"
+CONF_INK = "ink"
+CONF_DITHER = "dither"
+CONF_RENDER_BUDGET = "render_budget"
+CONF_ARENA_SIZE = "arena_size"
+CONF_BUSY_TIMEOUT = "busy_timeout"
+CONF_POWER_ON = "power_on"
+CONF_REFRESH = "refresh"
+CONF_POWER_OFF = "power_off"
+CONF_ON_REFRESH_COMPLETE = "on_refresh_complete"
+CONF_METRICS = "metrics"
+CONF_ELEMENT_COUNT = "element_count"
+CONF_DISPLAY_LIST_SIZE = "display_list_size"
+CONF_DITHER_BUFFER_SIZE = "dither_buffer_size"
+CONF_FREE_HEAP_BEFORE = "free_heap_before"
+CONF_FREE_HEAP_AFTER = "free_heap_after"
+CONF_LARGEST_FREE_BLOCK_BEFORE = "largest_free_block_before"
+CONF_LARGEST_FREE_BLOCK_AFTER = "largest_free_block_after"
+CONF_WRITER_TIME = "writer_time"
+CONF_BUILD_TIME = "build_time"
+CONF_RASTER_TIME = "raster_time"
+CONF_DITHER_TIME = "dither_time"
+CONF_SPI_TIME = "spi_time"
+CONF_BUSY_TIME = "busy_time"
+CONF_VISITS_PER_PIXEL = "visits_per_pixel"
+CONF_PROFILE = "profile"
+CONF_IMAGES = "images"
 
 ssd1306_spi = cg.esphome_ns.namespace("waveshare_epaper")
 WaveshareEPaper7P5InC = ssd1306_spi.class_("WaveshareEPaper7P5InC", display.Display, spi.SPIDevice)
+RefreshCompleteTrigger = ssd1306_spi.class_("RefreshCompleteTrigger", automation.Trigger.template())
+elements_ns = ssd1306_spi.namespace("elements")
+DitherMode = elements_ns.enum("DitherMode", is_class=True)
+PaletteImage = elements_ns.class_("PaletteImage")
+DITHER_MODES = {
+    "none": getattr(DitherMode, "None"),  # keyword in python
+    "error_diffusion": DitherMode.ErrorDiffusion,
+    "atkinson": DitherMode.Atkinson,
+    "ordered": DitherMode.Ordered,
+}
+
+# Must match Palette::lutBits in elements_palette.hpp
+PALETTE_LUT_BITS = 5
+# Must match PaletteImage::transparent in elements.hpp
+PALETTE_TRANSPARENT = 3
+
+
+def rgb_color(value):
+    value = cv.All(cv.ensure_list(cv.int_range(min=0, max=255)), cv.Length(min=3, max=3))(value)
+    return tuple(value)
+
+
+PALETTE_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_BLACK, default=[0, 0, 0]): rgb_color,
+        cv.Optional(CONF_WHITE, default=[255, 255, 255]): rgb_color,
+        cv.Optional(CONF_INK, default=[220, 180, 0]): rgb_color,
+    }
+)
+
+
+BUSY_TIMEOUT_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_POWER_ON, default="1s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_REFRESH, default="180s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_POWER_OFF, default="1s"): cv.positive_time_period_milliseconds,
+    }
+)
+
+
+def bytes_sensor_schema():
+    return sensor.sensor_schema(
+        unit_of_measurement=UNIT_BYTES,
+        icon="mdi:memory",
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    )
+
+
+def time_sensor_schema():
+    return sensor.sensor_schema(
+        unit_of_measurement=UNIT_MILLISECOND,
+        icon="mdi:timer-outline",
+        accuracy_decimals=1,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    )
+
+
+# Published with every rendered frame, each key maps to set_<key>_sensor
+METRICS_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_ELEMENT_COUNT): sensor.sensor_schema(
+            icon=ICON_COUNTER,
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_DISPLAY_LIST_SIZE): bytes_sensor_schema(),
+        cv.Optional(CONF_DITHER_BUFFER_SIZE): bytes_sensor_schema(),
+        cv.Optional(CONF_FREE_HEAP_BEFORE): bytes_sensor_schema(),
+        cv.Optional(CONF_FREE_HEAP_AFTER): bytes_sensor_schema(),
+        cv.Optional(CONF_LARGEST_FREE_BLOCK_BEFORE): bytes_sensor_schema(),
+        cv.Optional(CONF_LARGEST_FREE_BLOCK_AFTER): bytes_sensor_schema(),
+        cv.Optional(CONF_WRITER_TIME): time_sensor_schema(),
+        cv.Optional(CONF_BUILD_TIME): time_sensor_schema(),
+        cv.Optional(CONF_RASTER_TIME): time_sensor_schema(),
+        cv.Optional(CONF_DITHER_TIME): time_sensor_schema(),
+        cv.Optional(CONF_SPI_TIME): time_sensor_schema(),
+        cv.Optional(CONF_BUSY_TIME): time_sensor_schema(),
+        # need profile: true
+        cv.Optional(CONF_VISITS_PER_PIXEL): sensor.sensor_schema(
+            accuracy_decimals=2,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    }
+)
+
+PROFILE_METRICS = (CONF_VISITS_PER_PIXEL,)
+
+# Artwork quantized and dithered to the palette at build time, drawn with
+# it.image(x, y, id(...)) without any dithering at runtime
+IMAGE_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_ID): cv.declare_id(PaletteImage),
+        cv.Required(CONF_FILE): cv.file_,
+        cv.Optional(CONF_RESIZE): cv.dimensions,
+        cv.Optional(CONF_DITHER, default="error_diffusion"): cv.one_of(*DITHER_MODES, lower=True),
+        cv.GenerateID(CONF_RAW_DATA_ID): cv.declare_id(cg.uint8),
+    }
+)
+
+
+def validate_profile(config):
+    for key in PROFILE_METRICS:
+        if key in config[CONF_METRICS] and not config[CONF_PROFILE]:
+            raise cv.Invalid(f"{CONF_METRICS}: {key} needs {CONF_PROFILE}: true")
+    return config
+
+
+def validate_busy_pin(config):
+    if CONF_BUSY_PIN not in config:
+        refresh = config[CONF_BUSY_TIMEOUT][CONF_REFRESH]
+        _LOGGER.warning(
+            "No %s: every refresh waits the whole %s %s (%s) before "
+            "on_refresh_complete runs and the next update is accepted",
+            CONF_BUSY_PIN, CONF_BUSY_TIMEOUT, CONF_REFRESH, refresh,
+        )
+    return config
+
+
+def palette_colors(palette):
+    """Palette entries in Palette::Index order."""
+    return (palette[CONF_BLACK], palette[CONF_WHITE], palette[CONF_INK])
+
+
+def nearest(c, colors):
+    """Index of the entry closest to c, ties resolve the same way as
+    Palette::nearest: ink, then black, then white."""
+
+    def dist(p):
+        return sum((a - b) ** 2 for a, b in zip(c, p))
+
+    black, white, ink = colors
+    berr, werr, yerr = dist(black), dist(white), dist(ink)
+    bw = werr if werr < berr else berr
+    if bw < yerr:
+        return 1 if werr < berr else 0
+    return 2
+
+
+def palette_lut(palette):
+    """Nearest palette index for every cell of a reduced RGB cube, cells
+    are sampled at their centers.
+
+    Colors close to the boundary between two entries can get the other
+    one: at most one cell diagonal farther away than the nearest entry.
+    Palette entries themselves always map to themselves. The emulation's
+    differential test checks both.
+    """
+    levels = 1 << PALETTE_LUT_BITS
+    step = 256 // levels
+    colors = palette_colors(palette)
+    lut = []
+    for r in range(levels):
+        for g in range(levels):
+            for b in range(levels):
+                c = (r * step + step // 2, g * step + step // 2, b * step + step // 2)
+                lut.append(nearest(c, colors))
+    return lut
+
+
+# Same as bayerOffset in elements_dither.hpp
+BAYER = (
+    (0, 32, 8, 40, 2, 34, 10, 42),
+    (48, 16, 56, 24, 50, 18, 58, 26),
+    (12, 44, 4, 36, 14, 46, 6, 38),
+    (60, 28, 52, 20, 62, 30, 54, 22),
+    (3, 35, 11, 43, 1, 33, 9, 41),
+    (51, 19, 59, 27, 49, 17, 57, 25),
+    (15, 47, 7, 39, 13, 45, 5, 37),
+    (63, 31, 55, 23, 61, 29, 53, 21),
+)
+
+
+def diffusion_kernel(mode, x, width):
+    """(dx, dy, share of 32) of the error of pixel x, as RowRenderer
+    spreads it."""
+    if mode == "atkinson":
+        return ((1, 0, 4), (2, 0, 4), (-1, 1, 4), (0, 1, 4), (1, 1, 4), (0, 2, 4))
+    if x == 0:
+        return ((1, 0, 7), (0, 1, 7), (1, 1, 2))
+    if x == width - 1:
+        return ((-1, 1, 7), (0, 1, 9))
+    return ((1, 0, 7), (-1, 1, 3), (0, 1, 5), (1, 1, 1))
+
+
+def predither(pixels, width, height, colors, mode):
+    """Palette indices of RGBA pixels, dithered with the runtime kernels.
+
+    Pixels with alpha below 128 become transparent and, like solid pixels
+    at runtime, neither take nor spread error. Ordered dithering is aligned
+    to the image rather than the screen.
+    """
+
+    def opaque(x, y):
+        return pixels[y * width + x][3] >= 0x80
+
+    error = [[0.0, 0.0, 0.0] for _ in pixels]
+    indices = []
+    for y in range(height):
+        for x in range(width):
+            if not opaque(x, y):
+                indices.append(PALETTE_TRANSPARENT)
+                continue
+            e = error[y * width + x]
+            c = [v + e[k] for k, v in enumerate(pixels[y * width + x][:3])]
+            if mode == "ordered":
+                offset = BAYER[y & 7][x & 7] * 4 + 2 - 128
+                c = [v + offset for v in c]
+            i = nearest(c, colors)
+            indices.append(i)
+            if mode in ("none", "ordered"):
+                continue
+            quant = [v - p for v, p in zip(c, colors[i])]
+            for dx, dy, n in diffusion_kernel(mode, x, width):
+                nx, ny = x + dx, y + dy
+                if 0 <= nx < width and ny < height and opaque(nx, ny):
+                    target = error[ny * width + nx]
+                    for k in range(3):
+                        target[k] += quant[k] * n / 32
+    return indices
+
+
+def pack_indices(indices, width, height):
+    """Two bits per pixel, leftmost pixel in the high bits, rows padded to
+    whole bytes: the PaletteImage layout."""
+    stride = (width + 3) // 4
+    data = [0] * (stride * height)
+    for y in range(height):
+        for x in range(width):
+            data[y * stride + x // 4] |= indices[y * width + x] << (6 - 2 * (x % 4))
+    return data
+
+
+def load_image(conf):
+    try:
+        from PIL import Image
+    except ImportError as err:
+        raise core.EsphomeError("Please install the pillow python package to use images") from err
+    path = core.CORE.relative_config_path(conf[CONF_FILE])
+    try:
+        image = Image.open(path)
+    except Exception as err:
+        raise core.EsphomeError(f"Could not load image file {path}: {err}") from err
+    if CONF_RESIZE in conf:
+        image.thumbnail(conf[CONF_RESIZE])
+    image = image.convert("RGBA")
+    return image.width, image.height, list(image.getdata())
+
+
+def hex_color(c):
+    return (c[0] << 16) | (c[1] << 8) | c[2]
 
 
 CONFIG_SCHEMA = cv.All(
@@ -32,11 +331,30 @@ CONFIG_SCHEMA = cv.All(
                 cv.positive_time_period_milliseconds,
                 cv.Range(max=core.TimePeriod(milliseconds=500)),
             ),
+            cv.Optional(CONF_PALETTE, default={}): PALETTE_SCHEMA,
+            cv.Optional(CONF_DITHER, default="error_diffusion"): cv.enum(DITHER_MODES, lower=True),
+            cv.Optional(CONF_RENDER_BUDGET, default="20ms"): cv.All(
+                cv.positive_time_period_milliseconds,
+                cv.Range(min=core.TimePeriod(milliseconds=1)),
+            ),
+            cv.Optional(CONF_ARENA_SIZE, default=8192): cv.int_range(min=0, max=1 << 20),
+            cv.Optional(CONF_BUSY_TIMEOUT, default={}): BUSY_TIMEOUT_SCHEMA,
+            cv.Optional(CONF_METRICS, default={}): METRICS_SCHEMA,
+            cv.Optional(CONF_PROFILE, default=False): cv.boolean,
+            cv.Optional(CONF_IMAGES, default=[]): cv.ensure_list(IMAGE_SCHEMA),
+            cv.Optional(CONF_ON_REFRESH_COMPLETE): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(RefreshCompleteTrigger),
+                }
+            ),
+            cv.GenerateID(CONF_RAW_DATA_ID): cv.declare_id(cg.uint8),
         }
     )
     .extend(cv.polling_component_schema("600s"))
-    .extend(spi.spi_device_schema()),
+    .extend(spi.spi_device_schema(default_data_rate=2e6)),
     cv.has_at_most_one_key(CONF_PAGES, CONF_LAMBDA),
+    validate_profile,
+    validate_busy_pin,
 )
 
 
@@ -65,3 +383,34 @@ async def to_code(config):
         cg.add(var.set_full_update_every(config[CONF_FULL_UPDATE_EVERY]))
     if CONF_RESET_DURATION in config:
         cg.add(var.set_reset_duration(config[CONF_RESET_DURATION]))
+
+    palette = config[CONF_PALETTE]
+    cg.add(
+        var.set_palette(
+            hex_color(palette[CONF_BLACK]),
+            hex_color(palette[CONF_WHITE]),
+            hex_color(palette[CONF_INK]),
+        )
+    )
+    cg.add(var.set_dither_mode(config[CONF_DITHER]))
+    cg.add(var.set_render_budget(config[CONF_RENDER_BUDGET]))
+    cg.add(var.set_arena_size(config[CONF_ARENA_SIZE]))
+    busy_timeout = config[CONF_BUSY_TIMEOUT]
+    cg.add(var.set_power_on_timeout(busy_timeout[CONF_POWER_ON]))
+    cg.add(var.set_refresh_timeout(busy_timeout[CONF_REFRESH]))
+    cg.add(var.set_power_off_timeout(busy_timeout[CONF_POWER_OFF]))
+    if config[CONF_PROFILE]:
+        cg.add_define("EPAPER_PROFILE")
+    for key, conf in config[CONF_METRICS].items():
+        sens = await sensor.new_sensor(conf)
+        cg.add(getattr(var, f"set_{key}_sensor")(sens))
+    for conf in config.get(CONF_ON_REFRESH_COMPLETE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [], conf)
+    lut = cg.progmem_array(config[CONF_RAW_DATA_ID], palette_lut(palette))
+    cg.add(var.set_palette_lut(lut))
+    for conf in config[CONF_IMAGES]:
+        width, height, pixels = load_image(conf)
+        indices = predither(pixels, width, height, palette_colors(palette), conf[CONF_DITHER])
+        data = cg.progmem_array(conf[CONF_RAW_DATA_ID], pack_indices(indices, width, height))
+        cg.new_Pvariable(conf[CONF_ID], data, width, height)
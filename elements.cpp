@@ -1,4 +1,5 @@
 #include "elements.hpp"
+#include "elements_palette.hpp"
 
 #include <cmath>
 
@@ -69,6 +70,27 @@ Color3 col2pallete(Color3F c){
         .c);
 }
 
+// Squared distances keep the order of the sqrt ones of col2pallete and the
+// differences saturate like Color3F::operator- does there, so the default
+// palette picks exactly what the float path picks.
+int32_t colLenSq(Color3S_16 c, Color3 avail){
+    const int32_t r = sat8<int16_t, int32_t>(c.red - avail.red);
+    const int32_t g = sat8<int16_t, int32_t>(c.green - avail.green);
+    const int32_t b = sat8<int16_t, int32_t>(c.blue - avail.blue);
+    return r*r + g*g + b*b;
+}
+
+uint8_t Palette::nearest(const Color3S_16& c) const {
+    const auto berr = colLenSq(c, colors[Black].color);
+    const auto werr = colLenSq(c, colors[White].color);
+    const auto yerr = colLenSq(c, colors[Ink].color);
+    const auto bw = werr < berr ? werr : berr;
+    if(bw < yerr){
+        return werr < berr ? White : Black;
+    }
+    return Ink;
+}
+
 }  // namespace elements
 }  // namespace waveshare_epaper
 }  // namespace esphome
@@ -2,68 +2,164 @@
 
 #include "esphome/core/color.h"
 #ifndef IN_EMULATION
+#include "esphome/core/defines.h"
 #include "esphome/core/hal.h"
+#ifdef USE_ESP32
+#include "soc/soc.h"
+#endif // def USE_ESP32
 #endif // ndef IN_EMULATION
 #include "esphome/components/font/font.h"
 #include "esphome/components/image/image.h"
 
 #include <algorithm>
 
-#include <map>
+#include <memory>
 #include <variant>
 #include <vector>
 #include <cstdarg>
+#include <cstring>
 #include <cmath>
 #include "rtraits.hpp"
 
 #include "elements_color3.hpp"
 #include "elements_geometric.hpp"
+#include "elements_index.hpp"
+#include "elements_span.hpp"
+#include "elements_palette.hpp"
+#include "elements_dither.hpp"
+#include "elements_fingerprint.hpp"
+#include "elements_arena.hpp"
+#include "elements_memory.hpp"
+#include "elements_renderer.hpp"
 
 namespace esphome {
 namespace waveshare_epaper {
 namespace elements {
 
-Trait2(
+Trait6(
     Elemental,
     (boundingBox, Rect2D, (), const),
-    (pixAt, esphome::optional<Color3>, (int x, int y), const)
+    (pixAt, esphome::optional<Color3>, (int x, int y), const),
+    (spansAt, void, (int y, SpanSink& sink), const),
+    (fingerprint, void, (Fingerprint& fp), const),
+    (memoryUsage, void, (SceneMemory& m), const),
+    (kind, ElementKind, (), const)
 )
     
     
+// Polyline rasterized with the integer line stepping of the esphome core
+// Display::line. Every segment keeps one [x0, x1] run per row it crosses.
 class LineElement{
-    std::vector<Point2D> vertexes;
+    struct Run{
+        int16_t x0;
+        int16_t x1;
+    };
+    struct Segment{
+        int16_t top;
+        uint16_t rows;
+        uint16_t first;  // index of the run of row `top`
+    };
+    ArenaVector<Point2D> vertexes;
+    ArenaVector<Segment> segments;
+    ArenaVector<Run> runs;
     Color3 c;
     Rect2D bb;
 public:
-    LineElement(Color3 color, std::vector<Point2D> il):vertexes(std::move(il)), c(color), bb(calculateBoundingBox()){
+    template<typename Points>
+    LineElement(Color3 color, const Points& pts):vertexes(std::begin(pts), std::end(pts)), segments(), runs(), c(color), bb(calculateBoundingBox()){
+        rasterize();
     }
     esphome::optional<Color3> pixAt(int x, int y) const {
-        if(vertexes.size() < 2){
-            return esphome::nullopt;
-        }
-        const Point2D p{x,y};
-        if(!bb.has(p)){
-            return esphome::nullopt;
-        }
-        auto prev = vertexes.cbegin();
-        const auto e = vertexes.cend();
-        float prevd = ((*prev) - p).len();
-        for(auto i=prev+1; i!=e; ++i){
-            auto ld = ((*prev) - (*i)).len();
-            auto cd = ((*i) - p).len();
-            
-            if((prevd + cd - ld) < 0.01){
+        for(const auto& s:segments){
+            if(y < s.top || y >= s.top + s.rows){
+                continue;
+            }
+            const auto& r = runs[s.first + (y - s.top)];
+            if(x >= r.x0 && x <= r.x1){
                 return c;
             }
-            prevd = cd;
-            prev = i;
         }
         return esphome::nullopt;
     }
+    void spansAt(int y, SpanSink& sink) const {
+        for(const auto& s:segments){
+            if(y < s.top || y >= s.top + s.rows){
+                continue;
+            }
+            const auto& r = runs[s.first + (y - s.top)];
+            sink.fill(r.x0, r.x1, c);
+        }
+    }
     Rect2D boundingBox() const {
         return bb;
     }
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Line << c;
+        fp.bytes(vertexes.data(), vertexes.size() * sizeof(Point2D));
+    }
+    ElementKind kind() const {
+        return ElementKind::Line;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), capacityBytes(vertexes) + capacityBytes(segments) + capacityBytes(runs));
+    }
+    Color3 color() const {
+        return c;
+    }
+    // True for a single horizontal or vertical segment, r receives the
+    // pixels it covers
+    bool axisAligned(Rect2D& r) const {
+        if(vertexes.size() != 2){
+            return false;
+        }
+        if(vertexes[0].x != vertexes[1].x && vertexes[0].y != vertexes[1].y){
+            return false;
+        }
+        r = bb;
+        return true;
+    }
 private:
+    void rasterize(){
+        if(vertexes.size() < 2){
+            return;
+        }
+        size_t total = 0;
+        for(size_t i=1; i < vertexes.size(); ++i){
+            total += std::abs(vertexes[i].y - vertexes[i-1].y) + 1;
+        }
+        segments.reserve(vertexes.size() - 1);
+        runs.reserve(total);
+        for(size_t i=1; i < vertexes.size(); ++i){
+            int x1 = vertexes[i-1].x, y1 = vertexes[i-1].y;
+            const int x2 = vertexes[i].x, y2 = vertexes[i].y;
+            const int top = std::min(y1, y2);
+            const Segment s{int16_t(top), uint16_t(std::abs(y2 - y1) + 1), uint16_t(runs.size())};
+            runs.resize(runs.size() + s.rows, Run{INT16_MAX, INT16_MIN});
+            // Same stepping as esphome::display::Display::line
+            const int dx = std::abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+            const int dy = -std::abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+            int err = dx + dy;
+            while(true){
+                auto& r = runs[s.first + (y1 - top)];
+                r.x0 = std::min<int16_t>(r.x0, x1);
+                r.x1 = std::max<int16_t>(r.x1, x1);
+                if(x1 == x2 && y1 == y2){
+                    break;
+                }
+                const int e2 = 2 * err;
+                if(e2 >= dy){
+                    err += dy;
+                    x1 += sx;
+                }
+                if(e2 <= dx){
+                    err += dx;
+                    y1 += sy;
+                }
+            }
+            segments.push_back(s);
+        }
+    }
+    
     Rect2D calculateBoundingBox() const{
         if(vertexes.empty()){
             return Rect2D{};
@@ -112,9 +208,54 @@ public:
         return fill;
     }
     
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y){
+            return;
+        }
+        if(borders.has_value()){
+            if(y == rect.tl.y || y == rect.br.y){
+                sink.fill(rect.tl.x, rect.br.x, borders.value());
+                return;
+            }
+            sink.put(rect.tl.x, borders.value());
+            sink.put(rect.br.x, borders.value());
+            if(fill.has_value()){
+                sink.fill(rect.tl.x + 1, rect.br.x - 1, fill.value());
+            }
+            return;
+        }
+        if(fill.has_value()){
+            sink.fill(rect.tl.x, rect.br.x, fill.value());
+        }
+    }
+    
     Rect2D boundingBox() const{
         return rect;
     }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Rect << rect << borders << fill;
+    }
+    ElementKind kind() const {
+        return ElementKind::Rect;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), 0);
+    }
+    
+    // Every pixel of the bounding box is painted
+    bool opaque() const {
+        return fill.has_value();
+    }
+    
+    // Plain filled rectangle without a separate border color
+    bool solid() const {
+        return fill.has_value() && (!borders.has_value() || borders.value() == fill.value());
+    }
+    
+    esphome::optional<Color3> fillColor() const {
+        return fill;
+    }
 };
 
 
@@ -138,38 +279,132 @@ public:
         return fill;
     }
     
+    void spansAt(int y, SpanSink& sink) const {
+        int x0, x1;
+        if(tri.rowSpan(y, x0, x1)){
+            sink.fill(x0, x1, fill);
+        }
+    }
+    
     Rect2D boundingBox() const{
         return tri.boundingBox();
     }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Triangle << tri << fill;
+    }
+    ElementKind kind() const {
+        return ElementKind::Triangle;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), 0);
+    }
 };
 
+// Circle rasterized once with the midpoint algorithm of the esphome core
+// Display::circle. Row dy (distance from the center row) covers
+// |x - cx| in [inner, outer] for outlines and [0, outer] when filled.
 class CircleElement {
-    Circle2D tri;
+    struct Row{
+        uint16_t inner;
+        uint16_t outer;
+    };
+    Point2D center;
+    ArenaVector<Row> rows;
     Color3 fill;
     display::RegularPolygonDrawing drawing;
 public:
     CircleElement(Circle2D r, Color3 f, display::RegularPolygonDrawing d)
-        :tri(r), fill(f), drawing(d)
-    {}
+        :center(r.center), rows(), fill(f), drawing(d)
+    {
+        rasterize(int(r.radius));
+    }
     CircleElement(const CircleElement &) = default;
     CircleElement(CircleElement &&) = default;
     CircleElement &operator=(const CircleElement &) = default;
     CircleElement &operator=(CircleElement &&) = default;
     
     esphome::optional<Color3> pixAt(int x, int y) const {
-        const auto p = Point2D{x,y};
-        const auto has = tri.has(p);
-        if(has == HasPoint::Outside){
+        const size_t dy = std::abs(y - center.y);
+        if(dy >= rows.size()){
             return esphome::nullopt;
         }
-        if(has == HasPoint::OnBorder || drawing == display::DRAWING_FILLED){
+        const int dx = std::abs(x - center.x);
+        const auto& r = rows[dy];
+        if(dx > r.outer){
+            return esphome::nullopt;
+        }
+        if(drawing == display::DRAWING_FILLED || dx >= r.inner){
             return fill;
         }
         return esphome::nullopt;
     }
     
+    void spansAt(int y, SpanSink& sink) const {
+        const size_t dy = std::abs(y - center.y);
+        if(dy >= rows.size()){
+            return;
+        }
+        const auto& r = rows[dy];
+        if(drawing == display::DRAWING_FILLED){
+            sink.fill(center.x - r.outer, center.x + r.outer, fill);
+            return;
+        }
+        sink.fill(center.x - r.outer, center.x - r.inner, fill);
+        sink.fill(center.x + r.inner, center.x + r.outer, fill);
+    }
+    
     Rect2D boundingBox() const{
-        return tri.boundingBox();
+        if(rows.empty()){
+            return Rect2D{center, center - Point2D{1, 1}};
+        }
+        const auto rad = Point2D{rows.front().outer, int(rows.size()) - 1};
+        return Rect2D{
+            center - rad,
+            center + rad
+        };
+    }
+    
+    // rows are derived from the radius
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Circle << center << rows.size() << fill << drawing;
+    }
+    ElementKind kind() const {
+        return ElementKind::Circle;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), capacityBytes(rows));
+    }
+private:
+    void rasterize(int radius){
+        if(radius < 0){
+            return;
+        }
+        rows.resize(radius + 1, Row{uint16_t(radius), 0});
+        // Same stepping as esphome::display::Display::circle
+        int dx = -radius;
+        int dy = 0;
+        int err = 2 - 2 * radius;
+        int e2;
+        do {
+            auto& r = rows[dy];
+            r.inner = std::min<uint16_t>(r.inner, -dx);
+            r.outer = std::max<uint16_t>(r.outer, -dx);
+            e2 = err;
+            if (e2 < dy) {
+                err += ++dy * 2 + 1;
+                if (-dx == dy && e2 <= dx) {
+                    e2 = 0;
+                }
+            }
+            if (e2 > dx) {
+                err += ++dx * 2 + 1;
+            }
+        } while (dx <= 0);
+        // rows the stepping never reached
+        while(!rows.empty() && rows.back().inner > rows.back().outer){
+            rows.pop_back();
+        }
     }
 };
 
@@ -192,25 +427,45 @@ public:
         if(not rect.has(p)){
             return esphome::nullopt;
         }
-        const auto maxWidth = rect.br.x - rect.tl.x;
-        if(maxWidth == 0){
+        if(rect.width() == 0){
             return esphome::nullopt;
         }
-        const auto currentWidth = p.x - rect.tl.x;
-        const auto ret = Color3(
-            Color3F(start) + ((Color3F(end) - Color3F(start)) * (float(currentWidth) / maxWidth))
-        );
-        return ret;
+        return colorAt(x);
+    }
+    
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y || rect.width() == 0){
+            return;
+        }
+        sink.run(rect.tl.x, rect.br.x, [this](int x){ return colorAt(x); });
     }
     
     Rect2D boundingBox() const{
         return rect;
     }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Gradient << rect << start << end;
+    }
+    ElementKind kind() const {
+        return ElementKind::Gradient;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), 0);
+    }
+private:
+    Color3 colorAt(int x) const {
+        const auto maxWidth = rect.width();
+        const auto currentWidth = x - rect.tl.x;
+        return Color3(
+            Color3F(start) + ((Color3F(end) - Color3F(start)) * (float(currentWidth) / maxWidth))
+        );
+    }
 };
 
 class Texture{
     Rect2D rect;
-    std::vector<Color3> pixels;
+    ArenaVector<Color3> pixels;
     
 public:
     Texture():rect(),pixels(){}
@@ -234,21 +489,46 @@ public:
             return esphome::nullopt;
         }
         auto i = p - rect.tl;
-        return pixels.at(i.x + rect.width() * i.y);
+        return pixels.at(i.x + stride() * i.y);
+    }
+    
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y){
+            return;
+        }
+        const Color3 *row = pixels.data() + stride() * (y - rect.tl.y) - rect.tl.x;
+        sink.run(rect.tl.x, rect.br.x, [row](int x){ return row[x]; });
     }
     
     Rect2D boundingBox() const {
         return rect;
     }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Texture << rect;
+        fp.bytes(pixels.data(), pixels.size() * sizeof(Color3));
+    }
+    ElementKind kind() const {
+        return ElementKind::Texture;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), capacityBytes(pixels));
+    }
+private:
+    int stride() const {
+        return rect.width() + 1;
+    }
 };
 
 template<typename F>
 class TextureFunction{
     Rect2D rect;
     F func;
+    uint32_t key;
     
 public:
-    TextureFunction(Point2D pos, Point2D size, F f):rect{pos, pos + size}, func(std::move(f)){
+    // key identifies what func draws, e.g. a hash of its captures
+    TextureFunction(Point2D pos, Point2D size, F f, uint32_t k):rect{pos, pos + size}, func(std::move(f)), key(k){
     }
     TextureFunction(const TextureFunction &) = default;
     TextureFunction(TextureFunction &&) = default;
@@ -264,70 +544,747 @@ public:
         return func(i.x, i.y);
     }
     
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y){
+            return;
+        }
+        const int iy = y - rect.tl.y;
+        const int ox = rect.tl.x;
+        sink.run(rect.tl.x, rect.br.x, [this, iy, ox](int x){ return func(x - ox, iy); });
+    }
+    
     Rect2D boundingBox() const {
         return rect;
     }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::TextureFunction << rect << key;
+    }
+    ElementKind kind() const {
+        return ElementKind::TextureFunction;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), 0);
+    }
 };
 
 template<typename F>
-TextureFunction(Point2D pos, Point2D size, F f) -> TextureFunction<F>;
+TextureFunction(Point2D pos, Point2D size, F f, uint32_t k) -> TextureFunction<F>;
 
-struct FontGlyph{
-    const font::Glyph* glyph;
-    int bpp;
+// Whether p is in flash mapped data, which lives as long as the program
+// and never changes
+inline bool isStatic(const void *p){
+    const auto a = reinterpret_cast<uintptr_t>(p);
+#if defined(USE_ESP8266)
+    return a >= 0x40200000 && a < 0x40300000;
+#elif defined(USE_ESP32)
+    return a >= SOC_DROM_LOW && a < SOC_DROM_HIGH;
+#else
+    (void) a;
+    return false;
+#endif
+}
+
+// Image drawn with image(). Rows are decoded straight from the image data
+// with a loop per image type instead of a get_pixel() call, which
+// dispatches on the type again for every pixel. Icon sized binary and
+// grayscale images go through the frame's image cache as runs, so an icon
+// shown many times is decoded once per frame. Transparent pixels are left
+// alone, like Image::draw() does.
+class ImageElement{
+    const uint8_t *data;
+    Rect2D rect;
+    Color3 on;
+    Color3 off;
+    image::ImageType type;
+    bool transparent;
+
+    // Larger images are decoded per row without caching
+    constexpr static int cacheLimit = 128 * 128;
+public:
+    ImageElement(image::Image *img, Point2D pos, Color3 colorOn, Color3 colorOff):
+        data(img->get_data_start()),
+        rect{pos, pos + Point2D{img->get_width(), img->get_height()} - Point2D{1, 1}},
+        on(colorOn), off(colorOff), type(img->get_type()), transparent(img->has_transparency()){
+    }
+    ImageElement(const ImageElement &) = default;
+    ImageElement(ImageElement &&) = default;
+    ImageElement &operator=(const ImageElement &) = default;
+    ImageElement &operator=(ImageElement &&) = default;
+    
+    esphome::optional<Color3> pixAt(int x, int y) const {
+        if(not rect.has(Point2D{x, y})){
+            return esphome::nullopt;
+        }
+        return pixel(x - rect.tl.x, y - rect.tl.y);
+    }
+    
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y){
+            return;
+        }
+        const int ox = rect.tl.x;
+        const int iy = y - rect.tl.y;
+        const int ix0 = std::max(0, sink.left() - ox);
+        const int ix1 = std::min(width() - 1, sink.right() - ox);
+        if(ix0 > ix1){
+            return;
+        }
+        auto cache = sink.imageCache();
+        const RunCache::Rows *rows = nullptr;
+        if(cache != nullptr && cacheable()){
+            rows = cache->get(RunCache::Key{data, int(type), on, off}, [this](RunCache::Rows& out){
+                decode(out);
+            });
+        }
+        if(rows != nullptr){
+            for(auto r = rows->begin(iy), e = rows->end(iy); r != e; ++r){
+                sink.fill(ox + r->x0, ox + r->x1, r->c);
+            }
+            return;
+        }
+        switch(type){
+        case image::IMAGE_TYPE_BINARY:
+            binaryRow(iy, ix0, ix1, sink);
+            break;
+        case image::IMAGE_TYPE_GRAYSCALE:
+            pixelRow(iy, ix0, ix1, 1, sink, gray);
+            break;
+        case image::IMAGE_TYPE_RGB24:
+            pixelRow(iy, ix0, ix1, 3, sink, rgb24);
+            break;
+        case image::IMAGE_TYPE_RGB565:
+            pixelRow(iy, ix0, ix1, 2, sink, rgb565);
+            break;
+        case image::IMAGE_TYPE_RGBA:
+            pixelRow(iy, ix0, ix1, 4, sink, rgba);
+            break;
+        }
+    }
+    
+    Rect2D boundingBox() const {
+        return rect;
+    }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Image << rect << type << transparent << on << off;
+        // Images in RAM (online_image, animations) change in place
+        if(isStatic(data)){
+            fp << data;
+        }else{
+            fp.bytes(data, dataBytes());
+        }
+    }
+    ElementKind kind() const {
+        return ElementKind::Image;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), 0);
+    }
+private:
+    int width() const {
+        return rect.br.x - rect.tl.x + 1;
+    }
+    int height() const {
+        return rect.br.y - rect.tl.y + 1;
+    }
+    
+    size_t dataBytes() const {
+        switch(type){
+        case image::IMAGE_TYPE_BINARY:
+            return size_t(width() + 7) / 8 * height();
+        case image::IMAGE_TYPE_GRAYSCALE:
+            return size_t(width()) * height();
+        case image::IMAGE_TYPE_RGB24:
+            return size_t(width()) * height() * 3;
+        case image::IMAGE_TYPE_RGB565:
+            return size_t(width()) * height() * 2;
+        case image::IMAGE_TYPE_RGBA:
+            return size_t(width()) * height() * 4;
+        default:
+            return 0;
+        }
+    }
+    
+    bool cacheable() const {
+        return (type == image::IMAGE_TYPE_BINARY || type == image::IMAGE_TYPE_GRAYSCALE)
+            && width() * height() <= cacheLimit;
+    }
+    
+    // Pixel decoders, same colors and alpha as image::Image::get_pixel()
+    static Color gray(const uint8_t *p){
+        const uint8_t g = progmem_read_byte(p);
+        return Color(g, g, g, g == 1 ? 0 : 0xFF);
+    }
+    static Color rgb24(const uint8_t *p){
+        const uint8_t r = progmem_read_byte(p), g = progmem_read_byte(p + 1), b = progmem_read_byte(p + 2);
+        return Color(r, g, b, (r == 0 && g == 0 && b == 1) ? 0 : 0xFF);
+    }
+    static Color rgb565(const uint8_t *p){
+        const uint16_t v = (progmem_read_byte(p) << 8) | progmem_read_byte(p + 1);
+        const uint8_t r = (v & 0xF800) >> 11, g = (v & 0x07E0) >> 5, b = v & 0x001F;
+        return Color((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), v == 0x0020 ? 0 : 0xFF);
+    }
+    static Color rgba(const uint8_t *p){
+        return Color(progmem_read_byte(p), progmem_read_byte(p + 1), progmem_read_byte(p + 2), progmem_read_byte(p + 3));
+    }
+    
+    // The alpha of the decoders only counts for transparent images, and
+    // always for RGBA
+    bool opaque(const Color& c) const {
+        return c.w >= 0x80 || (!transparent && type != image::IMAGE_TYPE_RGBA);
+    }
+    
+    bool bit(int iy, int ix) const {
+        const int pos = iy * ((width() + 7) / 8) * 8 + ix;
+        return progmem_read_byte(data + pos / 8) & (0x80 >> (pos % 8));
+    }
+    
+    esphome::optional<Color3> pixel(int ix, int iy) const {
+        Color c;
+        switch(type){
+        case image::IMAGE_TYPE_BINARY:
+            if(bit(iy, ix)){
+                return on;
+            }
+            if(transparent){
+                return esphome::nullopt;
+            }
+            return off;
+        case image::IMAGE_TYPE_GRAYSCALE:
+            c = gray(data + (iy * width() + ix));
+            break;
+        case image::IMAGE_TYPE_RGB24:
+            c = rgb24(data + (iy * width() + ix) * 3);
+            break;
+        case image::IMAGE_TYPE_RGB565:
+            c = rgb565(data + (iy * width() + ix) * 2);
+            break;
+        case image::IMAGE_TYPE_RGBA:
+            c = rgba(data + (iy * width() + ix) * 4);
+            break;
+        default:
+            return esphome::nullopt;
+        }
+        if(not opaque(c)){
+            return esphome::nullopt;
+        }
+        return Color3(c);
+    }
+    
+    void decode(RunCache::Rows& out) const {
+        for(int iy=0; iy < height(); ++iy){
+            for(int ix=0; ix < width(); ++ix){
+                out.add(ix, pixel(ix, iy));
+            }
+            out.endRow();
+        }
+    }
+    
+    // Runs of equal bits become fills
+    void binaryRow(int iy, int ix0, int ix1, SpanSink& sink) const {
+        const int ox = rect.tl.x;
+        int start = ix0;
+        bool value = bit(iy, ix0);
+        for(int ix=ix0 + 1; ix <= ix1 + 1; ++ix){
+            const bool v = ix <= ix1 && bit(iy, ix);
+            if(ix <= ix1 && v == value){
+                continue;
+            }
+            if(value){
+                sink.fill(ox + start, ox + ix - 1, on);
+            }else if(not transparent){
+                sink.fill(ox + start, ox + ix - 1, off);
+            }
+            start = ix;
+            value = v;
+        }
+    }
+    
+    template<typename F>
+    void pixelRow(int iy, int ix0, int ix1, int bytes, SpanSink& sink, F decode) const {
+        const int ox = rect.tl.x;
+        const uint8_t *row = data + size_t(iy) * width() * bytes;
+        if(not transparent && type != image::IMAGE_TYPE_RGBA){
+            sink.run(ox + ix0, ox + ix1, [row, ox, bytes, decode](int x){
+                return Color3(decode(row + (x - ox) * bytes));
+            });
+            return;
+        }
+        for(int ix=ix0; ix <= ix1; ++ix){
+            const auto c = decode(row + ix * bytes);
+            if(opaque(c)){
+                sink.put(ox + ix, Color3(c));
+            }
+        }
+    }
 };
 
+// Pixels handed over with draw_pixels_at(), decoded row by row while
+// rendering with the same conversion as Display::draw_pixels_at(). Buffers
+// in flash live as long as the program and are referenced. Others, such as
+// LVGL or camera frame buffers, can be reused as soon as the call returns.
+// Those are copied as indices into a palette of the colors they use, when
+// there are at most 256 of them, or else as the nearest panel ink of every
+// pixel, 2 bits each.
+class BitmapElement{
+public:
+    struct Format{
+        display::ColorOrder order;
+        display::ColorBitness bitness;
+        bool bigEndian;
+    };
+private:
+    Rect2D rect;
+    const uint8_t *pixels;  // first pixel of the first row, unless copied
+    size_t stride;          // bytes from one row to the next
+    Format format;
+    ArenaVector<uint8_t> copy;
+    ArenaArray<Color3> palette;
+    uint8_t indexBits;      // per pixel in copy, 0 while referencing the source
+public:
+    // Copies are quantized against inks when they have too many colors
+    // for a palette of their own
+    BitmapElement(Point2D pos, Point2D size, const uint8_t *first, size_t rowBytes, Format f, bool reference,
+                  const Palette& inks = Palette()):
+        rect{pos, pos + size - Point2D{1, 1}}, pixels(first), stride(rowBytes), format(f),
+        copy(), palette(), indexBits(0){
+        if(not reference){
+            makeCopy(inks);
+        }
+    }
+    BitmapElement(const BitmapElement &) = default;
+    BitmapElement(BitmapElement &&) = default;
+    BitmapElement &operator=(const BitmapElement &) = default;
+    BitmapElement &operator=(BitmapElement &&) = default;
+    
+    static size_t pixelBytes(display::ColorBitness b){
+        switch(b){
+        case display::COLOR_BITNESS_888:
+            return 3;
+        case display::COLOR_BITNESS_565:
+            return 2;
+        default:
+            return 1;
+        }
+    }
+    
+    esphome::optional<Color3> pixAt(int x, int y) const {
+        if(not rect.has(Point2D{x, y})){
+            return esphome::nullopt;
+        }
+        const int ix = x - rect.tl.x;
+        const uint8_t *row = rowData(y - rect.tl.y);
+        if(indexBits != 0){
+            return palette[index(row, ix)];
+        }
+        return decode(row + ix * pixelBytes(format.bitness));
+    }
+    
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y){
+            return;
+        }
+        const int ox = rect.tl.x;
+        const uint8_t *row = rowData(y - rect.tl.y);
+        if(indexBits != 0){
+            sink.run(rect.tl.x, rect.br.x, [this, row, ox](int x){ return palette[index(row, x - ox)]; });
+            return;
+        }
+        const size_t bytes = pixelBytes(format.bitness);
+        sink.run(rect.tl.x, rect.br.x, [this, row, ox, bytes](int x){ return decode(row + (x - ox) * bytes); });
+    }
+    
+    Rect2D boundingBox() const {
+        return rect;
+    }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Bitmap << rect << format.order << format.bitness << format.bigEndian << indexBits;
+        if(pixels != nullptr){
+            fp << pixels << stride;
+            return;
+        }
+        fp.bytes(copy.data(), copy.size());
+        fp.bytes(palette.data(), palette.size() * sizeof(Color3));
+    }
+    ElementKind kind() const {
+        return ElementKind::Bitmap;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), capacityBytes(copy) + capacityBytes(palette));
+    }
+private:
+    int width() const {
+        return rect.br.x - rect.tl.x + 1;
+    }
+    int height() const {
+        return rect.br.y - rect.tl.y + 1;
+    }
+    
+    const uint8_t *rowData(int iy) const {
+        return (copy.empty() ? pixels : copy.data()) + iy * stride;
+    }
+    
+    Color3 decode(const uint8_t *p) const {
+        uint32_t v;
+        switch(format.bitness){
+        case display::COLOR_BITNESS_888:
+            v = format.bigEndian
+                ? (progmem_read_byte(p) << 16) | (progmem_read_byte(p + 1) << 8) | progmem_read_byte(p + 2)
+                : progmem_read_byte(p) | (progmem_read_byte(p + 1) << 8) | (progmem_read_byte(p + 2) << 16);
+            break;
+        case display::COLOR_BITNESS_565:
+            v = format.bigEndian
+                ? (progmem_read_byte(p) << 8) | progmem_read_byte(p + 1)
+                : progmem_read_byte(p) | (progmem_read_byte(p + 1) << 8);
+            break;
+        default:
+            v = progmem_read_byte(p);
+            break;
+        }
+        return Color3(display::ColorUtil::to_color(v, format.order, format.bitness));
+    }
+    
+    int index(const uint8_t *row, int ix) const {
+        const int bit = ix * indexBits;
+        const int mask = (1 << indexBits) - 1;
+        return (row[bit >> 3] >> (8 - indexBits - (bit & 7))) & mask;
+    }
+    
+    // Replaces the reference to the caller's buffer with a copy of palette
+    // indices
+    void makeCopy(const Palette& inks){
+        const int w = width(), h = height();
+        const size_t bytes = pixelBytes(format.bitness);
+        // First pass collects the colors, the second writes the indices,
+        // so no buffer the size of the bitmap is needed in between
+        size_t last = 0;
+        const auto find = [this, &last](Color3 c){
+            if(last >= palette.size() || not (palette[last] == c)){
+                last = std::find(palette.begin(), palette.end(), c) - palette.begin();
+            }
+            return last;
+        };
+        bool indexed = true;
+        for(int iy=0; iy < h && indexed; ++iy){
+            const uint8_t *row = pixels + iy * stride;
+            for(int ix=0; ix < w && indexed; ++ix){
+                const auto c = decode(row + ix * bytes);
+                if(find(c) == palette.size()){
+                    indexed = palette.size() < 256;
+                    palette.push_back(c);
+                }
+            }
+        }
+        // Too many colors (photos, camera frames): a copy of the source
+        // pixels would take up to 3 bytes a pixel, a full-screen RGB565
+        // buffer alone more than an ESP8266 has. The panel only shows its
+        // inks, so keep the nearest ink of every pixel, undithered.
+        if(not indexed){
+            palette = ArenaArray<Color3>();
+            for(uint8_t i=0; i < 3; ++i){
+                palette.push_back(inks[i].color);
+            }
+        }
+        palette.shrinkToFit();
+        indexBits = palette.size() <= 2 ? 1 : palette.size() <= 4 ? 2 : palette.size() <= 16 ? 4 : 8;
+        const size_t rowBytes = (size_t(w) * indexBits + 7) / 8;
+        copy.assign(rowBytes * h, 0);
+        for(int iy=0; iy < h; ++iy){
+            const uint8_t *row = pixels + iy * stride;
+            for(int ix=0; ix < w; ++ix){
+                const int bit = ix * indexBits;
+                const auto c = decode(row + ix * bytes);
+                const int i = indexed ? find(c) : inks.nearest(Color3S_16(c));
+                copy[iy * rowBytes + (bit >> 3)] |= i << (8 - indexBits - (bit & 7));
+            }
+        }
+        pixels = nullptr;
+        stride = rowBytes;
+    }
+};
 
-struct Glyph{
+// Artwork quantized and dithered to the panel palette by display.py (the
+// images: option). Two bits per pixel, four pixels per byte with the
+// leftmost in the high bits, rows padded to whole bytes. Values are
+// Palette::Index entries, or transparent.
+class PaletteImage{
+    const uint8_t *data;
+    int width;
+    int height;
+public:
+    constexpr static uint8_t transparent = 3;
+
+    PaletteImage(const uint8_t *data, int width, int height):data(data), width(width), height(height){}
+
+    int get_width() const {
+        return width;
+    }
+    int get_height() const {
+        return height;
+    }
+    const uint8_t *get_data_start() const {
+        return data;
+    }
+
+    size_t rowBytes() const {
+        return (size_t(width) + 3) / 4;
+    }
+    uint8_t index(int ix, int iy) const {
+        const uint8_t b = progmem_read_byte(data + iy * rowBytes() + ix / 4);
+        return (b >> (6 - 2 * (ix % 4))) & 3;
+    }
+};
+
+// A PaletteImage on screen. Its pixels need no error diffusion, the rows
+// are copied out as palette entries and sent as they are.
+class PaletteImageElement{
+    const PaletteImage *img;
+    const Palette *palette;
+    Rect2D rect;
+public:
+    PaletteImageElement(const PaletteImage *img, const Palette *palette, Point2D pos):
+        img(img), palette(palette),
+        rect{pos, pos + Point2D{img->get_width(), img->get_height()} - Point2D{1, 1}}{
+    }
+    PaletteImageElement(const PaletteImageElement &) = default;
+    PaletteImageElement(PaletteImageElement &&) = default;
+    PaletteImageElement &operator=(const PaletteImageElement &) = default;
+    PaletteImageElement &operator=(PaletteImageElement &&) = default;
+
+    esphome::optional<Color3> pixAt(int x, int y) const {
+        if(not rect.has(Point2D{x, y})){
+            return esphome::nullopt;
+        }
+        const uint8_t i = img->index(x - rect.tl.x, y - rect.tl.y);
+        if(i == PaletteImage::transparent){
+            return esphome::nullopt;
+        }
+        return (*palette)[i].color;
+    }
+
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y){
+            return;
+        }
+        const int ox = rect.tl.x;
+        const uint8_t *row = img->get_data_start() + (y - rect.tl.y) * img->rowBytes();
+        sink.paletteRun(rect.tl.x, rect.br.x, *palette, [row, ox](int x){
+            const int ix = x - ox;
+            return (progmem_read_byte(row + ix / 4) >> (6 - 2 * (ix % 4))) & 3;
+        });
+    }
+
+    Rect2D boundingBox() const {
+        return rect;
+    }
+
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::PaletteImage << rect << img->get_data_start();
+    }
+    ElementKind kind() const {
+        return ElementKind::PaletteImage;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), 0);
+    }
+};
+
+// Text of one print() call: glyph cells laid out left to right, each as
+// wide as its glyph and as tall as the font. Cells are kept in drawing order
+// as glyph indices into the font and screen x offsets.
+class TextRun{
+    struct Cell{
+        int16_t x;
+        uint16_t glyph;
+    };
+    font::Font *font;
+    ArenaVector<Cell> cells;
     Rect2D rect;
-    FontGlyph g;
+    int bpp;
     Color3 fg;
     esphome::optional<Color3> bg;
     esphome::optional<Color3F> diff;
     uint8_t bpp_max;
+    int maxWidth;
+    bool ordered;  // cell x never decreases, pixAt can binary search
 public:
-    Glyph(Point2D pos, Point2D size, FontGlyph glyph, Color3 color, esphome::optional<Color3> background):
-        rect{pos, pos + size - Point2D{1,1}},
-        g(glyph), fg(color), bg(background), diff(esphome::nullopt)
+    TextRun(font::Font *f, int y, Color3 color, esphome::optional<Color3> background):
+        font(f), cells(), rect{Point2D{0, y}, Point2D{-1, y + f->get_height() - 1}},
+        bpp(f->get_bpp()), fg(color), bg(background), diff(esphome::nullopt),
+        maxWidth(0), ordered(true)
     {
-        bpp_max = (1 << g.bpp) - 1;
+        bpp_max = (1 << bpp) - 1;
         if(bg.has_value()){
             diff = Color3F(color) - Color3F(bg.value());
         }
     }
+    
+    void add(int x, int glyph){
+        const int w = glyphData(glyph)->width;
+        if(cells.empty()){
+            rect.tl.x = x;
+            rect.br.x = x + w - 1;
+        }else{
+            ordered = ordered && x >= cells.back().x;
+            rect.tl.x = std::min(rect.tl.x, x);
+            rect.br.x = std::max(rect.br.x, x + w - 1);
+        }
+        maxWidth = std::max(maxWidth, w);
+        cells.push_back(Cell{int16_t(x), uint16_t(glyph)});
+    }
+    
+    // Moves the text by d, used once it is aligned
+    void shift(Point2D d){
+        for(auto& c: cells){
+            c.x += d.x;
+        }
+        rect.tl = rect.tl + d;
+        rect.br = rect.br + d;
+    }
+    
+    bool empty() const {
+        return cells.empty();
+    }
+    
+    // Arena memory is not reused, size the cell array once
+    void reserve(size_t n){
+        cells.reserve(n);
+    }
+    
     esphome::optional<Color3> pixAt(int x, int y) const {
-        const auto p = Point2D{x,y};
-        if(not rect.has(p)){
+        if(not rect.has(Point2D{x, y})){
             return esphome::nullopt;
         }
-        const auto gd = g.glyph->get_glyph_data();
-        const auto glyphTL = rect.tl + Point2D{gd->offset_x, gd->offset_y};
+        // later cells are drawn over earlier ones: check from the last cell
+        // starting at or before x back to the first one that could reach it
+        size_t i = cells.size();
+        if(ordered){
+            i = std::upper_bound(cells.begin(), cells.end(), x, [](int v, const Cell& c){ return v < c.x; }) - cells.begin();
+        }
+        while(i-- > 0){
+            const auto& c = cells[i];
+            if(ordered && c.x + maxWidth <= x){
+                break;
+            }
+            if(x >= c.x && x < c.x + glyphData(c.glyph)->width){
+                return cellPixAt(c, x, y);
+            }
+        }
+        return esphome::nullopt;
+    }
+    
+    void spansAt(int y, SpanSink& sink) const {
+        if(y < rect.tl.y || y > rect.br.y){
+            return;
+        }
+        for(const auto& c: cells){
+            cellSpansAt(c, y, sink);
+        }
+    }
+    
+    Rect2D boundingBox() const {
+        return rect;
+    }
+    
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Text << rect << font << bpp << fg << bg;
+        fp.bytes(cells.data(), cells.size() * sizeof(Cell));
+    }
+    ElementKind kind() const {
+        return ElementKind::Text;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), capacityBytes(cells));
+    }
+private:
+    const font::Glyph* glyphOf(int i) const {
+        return &font->get_glyphs()[i];
+    }
+    
+    const font::GlyphData* glyphData(int i) const {
+        return glyphOf(i)->get_glyph_data();
+    }
+    
+    esphome::optional<Color3> cellPixAt(const Cell& c, int x, int y) const {
+        const auto gd = glyphData(c.glyph);
+        const auto glyphTL = Point2D{c.x + gd->offset_x, rect.tl.y + gd->offset_y};
         Rect2D glyphRect = {
             glyphTL,
             glyphTL + Point2D{gd->width, gd->height} - Point2D{1, 1}
         };
+        const auto p = Point2D{x, y};
         if (not glyphRect.has(p)){
             return bg;
         }
         const auto i = p - glyphTL;
-        const auto dataposBits = (i.x + i.y * gd->width) * g.bpp;
-        
-        const auto dataposBytesBits = std::div(dataposBits, 8);
-        const uint8_t *data = gd->data + dataposBytesBits.quot;
-        uint8_t bitmask = 0x80 >> dataposBytesBits.rem;
-        auto pixel_data = progmem_read_byte(data++);
-        uint8_t pixel = 0;
-        for (int bit_num = 0; bit_num != g.bpp; bit_num++) {
-            if (bitmask == 0) {
-                pixel_data = progmem_read_byte(data++);
-                bitmask = 0x80;
+        return pixelColor(readPixel(gd->data, (i.x + i.y * gd->width) * bpp));
+    }
+    
+    void cellSpansAt(const Cell& c, int y, SpanSink& sink) const {
+        const auto gd = glyphData(c.glyph);
+        const int cx0 = c.x, cx1 = c.x + gd->width - 1;
+        const auto glyphTL = Point2D{c.x + gd->offset_x, rect.tl.y + gd->offset_y};
+        const int gy = y - glyphTL.y;
+        int gx0 = cx0, gx1 = cx0 - 1;
+        if(gy >= 0 && gy < gd->height){
+            gx0 = std::max(std::max(cx0, glyphTL.x), sink.left());
+            gx1 = std::min(std::min(cx1, glyphTL.x + gd->width - 1), sink.right());
+        }
+        if(bg.has_value()){
+            if(gx0 > gx1){
+                sink.fill(cx0, cx1, bg.value());
+                return;
             }
+            sink.fill(cx0, gx0 - 1, bg.value());
+            sink.fill(gx1 + 1, cx1, bg.value());
+        }
+        if(gx0 > gx1){
+            return;
+        }
+        const RunCache::Rows *rows = nullptr;
+        if(auto cache = sink.glyphCache()){
+            rows = cache->get(RunCache::Key{glyphOf(c.glyph), bpp, fg, bg}, [this, gd](RunCache::Rows& out){
+                decode(gd, out);
+            });
+        }
+        if(rows != nullptr){
+            for(auto r = rows->begin(gy), e = rows->end(gy); r != e; ++r){
+                sink.fill(std::max(glyphTL.x + r->x0, gx0), std::min(glyphTL.x + r->x1, gx1), r->c);
+            }
+            return;
+        }
+        int bitpos = (gx0 - glyphTL.x + gy * gd->width) * bpp;
+        for(int x=gx0; x <= gx1; ++x, bitpos += bpp){
+            const auto color = pixelColor(readPixel(gd->data, bitpos));
+            if(color.has_value()){
+                sink.put(x, color.value());
+            }
+        }
+    }
+    
+    void decode(const font::GlyphData *gd, RunCache::Rows& out) const {
+        int bitpos = 0;
+        for(int y=0; y < gd->height; ++y){
+            for(int x=0; x < gd->width; ++x, bitpos += bpp){
+                out.add(x, pixelColor(readPixel(gd->data, bitpos)));
+            }
+            out.endRow();
+        }
+    }
+    
+    uint8_t readPixel(const uint8_t *data, int bitpos) const {
+        uint8_t pixel = 0;
+        for (int bit_num = 0; bit_num != bpp; bit_num++, bitpos++) {
             pixel <<= 1;
-            if ((pixel_data & bitmask) != 0)
+            if (progmem_read_byte(data + (bitpos >> 3)) & (0x80 >> (bitpos & 7)))
                 pixel |= 1;
-            bitmask >>= 1;
         }
-        
+        return pixel;
+    }
+    
+    esphome::optional<Color3> pixelColor(uint8_t pixel) const {
         if (pixel == bpp_max) {
             return fg;
         } else if (pixel != 0) {
@@ -341,46 +1298,117 @@ public:
         }
         return esphome::nullopt;
     }
-    Rect2D boundingBox() const {
-        return rect;
-    }
 };
 
-class SparseTexture{
-    std::map<Point2D, Color3> m;
+// Pixels drawn one by one with draw_pixel_at, as runs of equal color
+// sorted by row and x, so memory and lookups scale with touched rows and
+// color changes rather than with pixels. Later pixels overwrite earlier
+// ones. The runs are one ArenaArray, which grows in place while pixels
+// keep coming.
+class PixelLayer{
+    struct Run{
+        int16_t y;
+        int16_t x0;
+        int16_t x1;
+        Color3 c;
+    };
+    ArenaArray<Run> runs;
+    Rect2D bb;
 
 public:
-    SparseTexture() = default;
-    SparseTexture(const SparseTexture &) = default;
-    SparseTexture(SparseTexture &&) = default;
-    SparseTexture &operator=(const SparseTexture &) = default;
-    SparseTexture &operator=(SparseTexture &&) = default;
+    PixelLayer():runs(), bb{Point2D{0, 0}, Point2D{-1, -1}}{}
+    PixelLayer(const PixelLayer &) = default;
+    PixelLayer(PixelLayer &&) = default;
+    PixelLayer &operator=(const PixelLayer &) = default;
+    PixelLayer &operator=(PixelLayer &&) = default;
     
     void insert(Point2D pos, Color3 color){
-        m.insert(std::pair<Point2D, Color3>(pos, color));
+        if(runs.empty()){
+            bb = Rect2D{pos, pos};
+        }else{
+            bb = bb.unite(Rect2D{pos, pos});
+        }
+        insertRun(pos.y, pos.x, color);
     }
 
     esphome::optional<Color3> pixAt(int x, int y) const {
-        auto iter = m.find(Point2D{x, y});
-        if (iter != m.end()) {
-            return esphome::optional<Color3>{iter->second};
+        const auto row = rowRange(y);
+        auto it = std::upper_bound(row.first, row.second, x, [](int v, const Run& r){ return v < r.x0; });
+        if(it == row.first || (it - 1)->x1 < x){
+            return esphome::nullopt;
+        }
+        return (it - 1)->c;
+    }
+    
+    void spansAt(int y, SpanSink& sink) const {
+        const auto row = rowRange(y);
+        for(auto r = row.first; r != row.second; ++r){
+            sink.fill(r->x0, r->x1, r->c);
         }
-        return esphome::nullopt;
     }
     
     Rect2D boundingBox() const {
-        if(m.size() > 0){
-            return Rect2D{
-                m.begin()->first,
-                m.rbegin()->first
-            };
+        return bb;
+    }
+    
+    // Pixels are added after the layer is appended, Elements hashes
+    // them as they come
+    void fingerprint(Fingerprint& fp) const {
+        fp << ElementKind::Pixels;
+    }
+    ElementKind kind() const {
+        return ElementKind::Pixels;
+    }
+    void memoryUsage(SceneMemory& m) const {
+        m.add(kind(), sizeof(*this), capacityBytes(runs));
+    }
+private:
+    // Runs of row y
+    std::pair<const Run*, const Run*> rowRange(int y) const {
+        return std::equal_range(runs.begin(), runs.end(), Run{int16_t(y), 0, 0, Color3{}},
+                                [](const Run& a, const Run& b){ return a.y < b.y; });
+    }
+    
+    void insertRun(int y, int x, Color3 c){
+        const auto row = rowRange(y);
+        const size_t lo = row.first - runs.begin();
+        size_t hi = row.second - runs.begin();
+        auto i = size_t(std::upper_bound(row.first, row.second, x, [](int v, const Run& r){ return v < r.x0; }) - runs.begin());
+        const int16_t y16 = int16_t(y);
+        if(i > lo && runs[i - 1].x1 >= x){
+            // inside an existing run: keep the parts of it left and right of x
+            const Run r = runs[i - 1];
+            if(r.c == c){
+                return;
+            }
+            --i;
+            runs.erase(i);
+            --hi;
+            if(r.x1 > x){
+                runs.insert(i, Run{y16, int16_t(x + 1), r.x1, r.c});
+                ++hi;
+            }
+            if(r.x0 < x){
+                runs.insert(i, Run{y16, r.x0, int16_t(x - 1), r.c});
+                ++hi;
+                ++i;
+            }
+        }
+        runs.insert(i, Run{y16, int16_t(x), int16_t(x), c});
+        ++hi;
+        // join the neighbors of the same color, so overdrawing an area
+        // does not leave a run per pixel behind
+        if(i + 1 < hi && runs[i + 1].x0 == x + 1 && runs[i + 1].c == c){
+            runs[i].x1 = runs[i + 1].x1;
+            runs.erase(i + 1);
+        }
+        if(i > lo && runs[i - 1].x1 == x - 1 && runs[i - 1].c == c){
+            runs[i - 1].x1 = runs[i].x1;
+            runs.erase(i);
         }
-        return Rect2D{};
     }
 };
 
-using Element = std::variant<Texture, SparseTexture, LinearGradient>;
-
 namespace detail{
 template <typename T>
 struct reversion_wrapper { T& iterable; };
@@ -393,137 +1421,302 @@ auto end (reversion_wrapper<T> w) { return std::rend(w.iterable); }
 
 template <typename T>
 reversion_wrapper<T> reverse (T&& iterable) { return { iterable }; }
+
+// std::visit over a single variant as a chain of index compares, which the
+// compiler can inline completely instead of calling through a jump table
+template<size_t I=0, typename F, typename... Ts>
+decltype(auto) visit(F&& f, const std::variant<Ts...>& v){
+    if constexpr(I + 1 < sizeof...(Ts)){
+        if(v.index() != I){
+            return visit<I + 1>(std::forward<F>(f), v);
+        }
+    }
+    return f(*std::get_if<I>(&v));
+}
 }
 
+// Summary of the optimization pass run by Elements::finalize
+struct SceneStats{
+    size_t total;        // elements appended by the writer
+    size_t offscreen;    // dropped, no pixel on the screen
+    size_t occluded;     // dropped, fully covered by a later opaque rect
+    size_t merged;       // dropped, merged into an adjacent same-color rect
+    size_t linesAsRects; // axis-aligned lines converted to rects
+    
+    size_t removed() const {
+        return offscreen + occluded + merged;
+    }
+    size_t remaining() const {
+        return total - removed();
+    }
+};
+
 template<typename Base>
-class Elements{
-    std::vector<Elemental_Owning> els;
-    Color3 bg;
-    Color3S_16 dither[Base::static_width_()*2];
-#ifdef IN_EMULATION
-    Color3 origR[Base::static_width_()*2];
-#endif//def IN_EMULATION
+class Elements: public RowRenderer<Base, Elements<Base>>{
+    friend class RowRenderer<Base, Elements<Base>>;
+    struct Entry{
+        Elemental_Owning el;
+        Rect2D bb;
+        bool dither;
+    };
+    // declared first: elements placed in it are destroyed before it
+    Arena arena;
+    std::vector<Entry> els;
+    SceneIndex<Base::static_width_(), Base::static_height_()> index;
+    bool indexed;
+    bool ditherNext;     // applied to elements appended from now on
+    Fingerprint fp;
 public:
-    Elements():els(), bg(0,0,0){
+    Elements():arena(), els(), index(), indexed(false), ditherNext(true), fp(){
     }
     
-    void fill(Color3 bg){
-        this->bg = bg;
+    // Elements appended while dithering is disabled (solid text, UI chrome)
+    // are quantized straight to the nearest palette color, they neither
+    // take nor spread diffusion error.
+    void set_dithering(bool enabled){
+        ditherNext = enabled;
     }
     
     template<typename T, typename... A>
     T* append_element(A... e){
-        els.emplace_back(makeElemental<T>(std::forward<A>(e)...));
-        return trait_cast<T>(els.back());
+        Arena::Scope scope(&arena);
+        push(make<T>(std::forward<A>(e)...));
+        return trait_cast<T>(els.back().el);
     }
     
     template<template<typename...>typename T, typename... TP, typename... A>
     void append_element(A... e){
+        Arena::Scope scope(&arena);
         T t{std::forward<A>(e)...};
-        els.emplace_back(makeElemental<decltype(t)>(std::move(t)));
+        push(make<decltype(t)>(std::move(t)));
         // return trait_cast<T>(els.back());
     }
+    
+    // Element memory is reserved up front and reused by every update
+    void set_arena_capacity(size_t bytes){
+        arena.setCapacity(bytes);
+    }
+    
+    const Arena& memory() const {
+        return arena;
+    }
 
-    Color3 pixAt(int x, int y) const{
-        esphome::optional<Color3> ret{esphome::nullopt};
-        auto elsR =  detail::reverse(els);
-        for(const auto& el:elsR){
-            ret = el.pixAt(x,y);
-            if(ret.has_value()){
-                return ret.value();
+    // Per-kind element counts and bytes held by the display list
+    SceneMemory memoryUsage() const {
+        SceneMemory m;
+        for(const auto& e:els){
+            e.el.memoryUsage(m);
+        }
+        m.listBytes = capacityBytes(els) + index.memoryBytes();
+        return m;
+    }
+
+    // Compiles the display list once the writer lambda has finished:
+    // clips bounding boxes to the screen, turns axis-aligned lines into
+    // rects, drops off-screen and occluded elements, merges adjacent
+    // same-color rects and builds the row index.
+    SceneStats finalize(){
+        SceneStats stats{els.size(), 0, 0, 0, 0};
+        const Rect2D screen{
+            Point2D{0, 0},
+            Point2D{Base::static_width_() - 1, Base::static_height_() - 1}
+        };
+        for(auto& e:els){
+            Rect2D r;
+            const auto line = trait_cast<LineElement>(e.el);
+            if(line != nullptr && line->axisAligned(r)){
+                e.el = make<RectElement>(r, esphome::nullopt, line->color());
+                ++stats.linesAsRects;
+            }
+            e.bb = e.el.boundingBox().intersect(screen);
+        }
+        
+        // Top to bottom: anything inside an opaque rect above it is hidden.
+        // Dropped elements are marked with an empty bounding box.
+        std::vector<Rect2D> occluders;
+        for(auto& e:detail::reverse(els)){
+            if(e.bb.empty()){
+                ++stats.offscreen;
+                continue;
+            }
+            const bool hidden = std::any_of(
+                std::begin(occluders), std::end(occluders),
+                [&e](const Rect2D& o){ return o.has(e.bb); });
+            if(hidden){
+                e.bb = Rect2D{Point2D{0, 0}, Point2D{-1, -1}};
+                ++stats.occluded;
+                continue;
+            }
+            const auto rect = trait_cast<RectElement>(e.el);
+            if(rect != nullptr && rect->opaque()){
+                occluders.push_back(e.bb);
+            }
+        }
+        
+        // Bottom to top: merge neighbours in z-order which form a rect
+        RectElement *last = nullptr;
+        Entry *lastEntry = nullptr;
+        for(auto& e:els){
+            if(e.bb.empty()){
+                continue;
+            }
+            const auto rect = trait_cast<RectElement>(e.el);
+            if(rect == nullptr || !rect->solid()){
+                last = nullptr;
+                continue;
+            }
+            if(last != nullptr && lastEntry->dither == e.dither
+               && last->fillColor().value() == rect->fillColor().value()){
+                const auto a = last->boundingBox();
+                const auto b = rect->boundingBox();
+                const bool columns = a.tl.x == b.tl.x && a.br.x == b.br.x
+                    && b.tl.y <= a.br.y + 1 && a.tl.y <= b.br.y + 1;
+                const bool rows = a.tl.y == b.tl.y && a.br.y == b.br.y
+                    && b.tl.x <= a.br.x + 1 && a.tl.x <= b.br.x + 1;
+                if(columns || rows){
+                    const auto u = a.unite(b);
+                    lastEntry->el = make<RectElement>(u, esphome::nullopt, rect->fillColor());
+                    lastEntry->bb = u.intersect(screen);
+                    last = trait_cast<RectElement>(lastEntry->el);
+                    e.bb = Rect2D{Point2D{0, 0}, Point2D{-1, -1}};
+                    ++stats.merged;
+                    continue;
+                }
             }
+            last = rect;
+            lastEntry = &e;
         }
-        return bg;
+        
+        els.erase(
+            std::remove_if(std::begin(els), std::end(els), [](const Entry& e){ return e.bb.empty(); }),
+            std::end(els));
+        buildIndex(false);
+        return stats;
     }
 
-    template<typename F>
-    void render(F&& f){
-        size_t dither_current=0;
-        size_t dither_next=Base::static_width_();
-        {
-            size_t x = 0;
-            std::generate_n(std::begin(dither)+dither_current, Base::static_width_(), [this, &x]() ->Color3{
-                return Color3{pixAt(x++,0)};
-            });
+    // Builds row buckets of the display list, must be called after the
+    // writer lambda has finished and before pixAt is used by render.
+    void buildIndex(bool refreshBoundingBoxes=true){
+        if(refreshBoundingBoxes){
+            for(auto& e:els){
+                e.bb = e.el.boundingBox();
+            }
         }
-#ifdef IN_EMULATION
-        std::copy(std::begin(dither), std::end(dither), std::begin(origR));
-#endif//def IN_EMULATION
-        for(size_t y=0; y < Base::static_height_(); ++y){
-            size_t x = 0;
-            std::generate_n(std::begin(dither)+dither_next, Base::static_width_(), [this, &x, y]() ->Color3{
-                return Color3{pixAt(x++,y)};
-            });
-#ifdef IN_EMULATION
-            std::copy_n(std::begin(dither)+dither_next, Base::static_width_(), std::begin(origR)+dither_next);
-#endif//def IN_EMULATION
-            for(size_t x=0; x < Base::static_width_(); ++x){
-                const auto currentPix = dither[x+dither_current];
-                const auto pallettePix = col2pallete(Color3F{currentPix});
-                const auto quantError = Color3F(currentPix) - unb(Color3F(pallettePix));
-                if(x == 0){
-                    dither[x + 1 + dither_current   ] += Color3S_16(quantError * unb<float>(7./32.));
-                    dither[x     + dither_next      ] += Color3S_16(quantError * unb<float>(7./32.));
-                    dither[x + 1 + dither_next      ] += Color3S_16(quantError * unb<float>(2./32.));
-                }else if(x == Base::static_width_()-1){
-                    dither[x - 1 + dither_next      ] += Color3S_16(quantError * unb<float>(7./32.));
-                    dither[x     + dither_next      ] += Color3S_16(quantError * unb<float>(9./32.));
-                }else {
-                    dither[x + 1 + dither_current   ] += Color3S_16(quantError * unb<float>(7./32.));
-                    dither[x - 1 + dither_next      ] += Color3S_16(quantError * unb<float>(3./32.));
-                    dither[x     + dither_next      ] += Color3S_16(quantError * unb<float>(5./32.));
-                    dither[x + 1 + dither_next      ] += Color3S_16(quantError * unb<float>(1./32.));
+        index.build(els.size(), [this](size_t i) -> const Rect2D& { return els[i].bb; });
+        indexed = true;
+    }
+
+    Color3 pixAt(int x, int y) const{
+        const Point2D p{x, y};
+        if(not indexed){
+            for(const auto& e:detail::reverse(els)){
+                const auto ret = e.el.pixAt(x,y);
+                if(ret.has_value()){
+                    return ret.value();
                 }
-                f(
-                    x
-                    , y
-                    , pallettePix
-#ifdef IN_EMULATION
-                    , Color3(origR[x+dither_current])
-                    , Color3(currentPix)
-#endif//def IN_EMULATION                    
-                );
             }
-            std::swap(dither_current, dither_next);
+            return this->bg;
         }
+        const auto first = index.begin(y);
+        for(auto i = index.end(y); i != first;){
+            const auto& e = els[*--i];
+            if(not e.bb.has(p)){
+                continue;
+            }
+            const auto ret = e.el.pixAt(x,y);
+            if(ret.has_value()){
+                return ret.value();
+            }
+        }
+        return this->bg;
     }
 
     void clear(){
         els.clear();
+        arena.reset();
+        index.clear();
+        indexed = false;
+        ditherNext = true;
+        fp = Fingerprint();
+        this->resetRender();
+    }
+    
+    // Hash of everything that affects the rendered frame, computed while
+    // elements are appended so comparing frames does not need a render
+    uint32_t fingerprint() const {
+        auto f = fp;
+        f << this->bg << this->ditherMode;
+        for(uint8_t i=0; i < 3; ++i){
+            f << this->palette[i].color;
+        }
+        return f.value();
     }
     void draw_pixel_at(int x, int y){
         draw_pixel_at(x, y, display::COLOR_ON);
     }
     void draw_pixel_at(int x, int y, Color color){
-        SparseTexture *sp;
-        if(els.empty()){
-            sp = append_element<SparseTexture>();
+        // consecutive pixels share a layer, anything drawn in between
+        // starts a new one to keep the z-order
+        Arena::Scope scope(&arena);
+        PixelLayer *layer = nullptr;
+        if(!els.empty() && els.back().dither == ditherNext){
+            layer = trait_cast<PixelLayer>(els.back().el);
+        }
+        if(layer == nullptr){
+            layer = append_element<PixelLayer>();
         }
-        sp->insert(Point2D{x,y}, Color3{color});
+        layer->insert(Point2D{x,y}, Color3{color});
+        indexed = false;
+        fp << Point2D{x,y} << Color3{color};
     }
     
     void draw_pixels_at(int x_start, int y_start, int w, int h, const uint8_t *ptr, display::ColorOrder order,
-                        display::ColorBitness bitness, bool big_endian, int x_offset, int y_offset, int x_pad){}
+                        display::ColorBitness bitness, bool big_endian, int x_offset, int y_offset, int x_pad){
+        if(w <= 0 || h <= 0){
+            return;
+        }
+        const size_t bytes = BitmapElement::pixelBytes(bitness);
+        const size_t lineStride = size_t(x_offset + w + x_pad) * bytes;
+        const uint8_t *first = ptr + y_offset * lineStride + x_offset * bytes;
+        append_element<BitmapElement>(
+            Point2D{x_start, y_start}, Point2D{w, h}, first, lineStride,
+            BitmapElement::Format{order, bitness, big_endian}, isStatic(ptr), this->palette
+        );
+    }
     
     void line(int x1, int y1, int x2, int y2, Color color = display::COLOR_ON){
         append_element<LineElement>(
-            Color3{color}, std::vector<Point2D>{ Point2D{x1,y1}, Point2D{x2, y2} }
+            Color3{color}, std::array<Point2D, 2>{ Point2D{x1,y1}, Point2D{x2, y2} }
         );
     }
     
-    void line_at_angle(int x, int y, int angle, int length, Color color = display::COLOR_ON);
+    void line_at_angle(int x, int y, int angle, int length, Color color = display::COLOR_ON){
+        line_at_angle(x, y, angle, 0, length, color);
+    }
     
-    void line_at_angle(int x, int y, int angle, int start_radius, int stop_radius, Color color = display::COLOR_ON);
+    void line_at_angle(int x, int y, int angle, int start_radius, int stop_radius, Color color = display::COLOR_ON){
+        const int x1 = (start_radius * cos(angle * M_PI / 180)) + x;
+        const int y1 = (start_radius * sin(angle * M_PI / 180)) + y;
+        const int x2 = (stop_radius * cos(angle * M_PI / 180)) + x;
+        const int y2 = (stop_radius * sin(angle * M_PI / 180)) + y;
+        line(x1, y1, x2, y2, color);
+    }
     
     void horizontal_line(int x, int y, int width, Color color = display::COLOR_ON){
+        if(width <= 0){
+            return;
+        }
         append_element<LineElement>(
-            Color3{color}, std::vector<Point2D>{ Point2D{x,y}, Point2D{x+width, y} }
+            Color3{color}, std::array<Point2D, 2>{ Point2D{x,y}, Point2D{x + width - 1, y} }
         );
     }
     
     void vertical_line(int x, int y, int height, Color color = display::COLOR_ON){
+        if(height <= 0){
+            return;
+        }
         append_element<LineElement>(
-            Color3{color}, std::vector<Point2D>{ Point2D{x,y}, Point2D{x, y + height} }
+            Color3{color}, std::array<Point2D, 2>{ Point2D{x,y}, Point2D{x, y + height - 1} }
         );
     }
     
@@ -557,7 +1750,7 @@ public:
     
     void triangle(int x1, int y1, int x2, int y2, int x3, int y3, Color color = display::COLOR_ON){
         append_element<LineElement>(
-            Color3{color}, std::vector<Point2D>{ Point2D{x1,y1}, Point2D{x2, y2}, Point2D{x3, y3}, Point2D{x1,y1} }
+            Color3{color}, std::array<Point2D, 4>{ Point2D{x1,y1}, Point2D{x2, y2}, Point2D{x3, y3}, Point2D{x1,y1} }
         );
     }
     
@@ -611,7 +1804,7 @@ public:
                 previous_vertex_y = current_vertex_y;
             }
             if (drawing == display::DRAWING_OUTLINE) {
-                append_element<LineElement>(Color3{color}, std::move(pts));
+                append_element<LineElement>(Color3{color}, pts);
             }
         }
     }
@@ -650,15 +1843,9 @@ public:
         bool has_char = false;
         int x = 0;
         const auto& glyphs = font->get_glyphs();
-        struct GlyphArgs{
-            Point2D pos;
-            Point2D size;
-            FontGlyph glyph;
-            Color3 color;
-            esphome::optional<Color3> background;
-            GlyphArgs(Point2D p,Point2D s,FontGlyph g,Color3 c,esphome::optional<Color3> b):pos(p),size(s),glyph(g),color(c),background(b){}
-        };
-        std::vector<GlyphArgs> textGlyphs;
+        Arena::Scope scope(&arena);
+        TextRun run{font, 0, Color3{color}, bg};
+        run.reserve(strlen(text));
         while (text[i] != '\0') {
             int match_length;
             int glyph_n = font->match_next_glyph((const uint8_t *) text + i, &match_length);
@@ -670,14 +1857,13 @@ public:
                 continue;
             }
             
-            const font::Glyph &glyph = glyphs[glyph_n];
-            const auto glyphData = glyph.get_glyph_data();
+            const auto glyphData = glyphs[glyph_n].get_glyph_data();
             if (!has_char) {
                 min_x = glyphData->offset_x;
             } else {
                 min_x = std::min(min_x, x + glyphData->offset_x);
             }
-            textGlyphs.emplace_back(Point2D{x, 0}, Point2D{glyphData->width, height}, FontGlyph{&glyph, font->get_bpp()}, Color3{color}, bg);
+            run.add(x, glyph_n);
             x += glyphData->width + glyphData->offset_x;
             i += match_length;
             has_char = true;
@@ -714,9 +1900,11 @@ public:
             break;
         }
         
-        for(auto& i:textGlyphs){
-            append_element<Glyph>(i.pos + Point2D{xp, yp}, i.size, i.glyph, i.color, i.background);
+        if(run.empty()){
+            return;
         }
+        run.shift(Point2D{xp, yp});
+        append_element<TextRun>(std::move(run));
     }
     
     void print(int x, int y, font::Font *font, Color color, const char *text, Color background = display::COLOR_OFF){
@@ -805,15 +1993,27 @@ public:
     }
     
     void image(int x, int y, image::Image *image, display::ImageAlign align, Color color_on = display::COLOR_ON, Color color_off = display::COLOR_OFF){
+        align_image(x, y, image->get_width(), image->get_height(), align);
+        append_element<ImageElement>(image, Point2D{x,y}, Color3{color_on}, Color3{color_off});
+    }
+
+    // Artwork pre-dithered by display.py, drawn in the panel colors as is
+    void image(int x, int y, const PaletteImage *image, display::ImageAlign align = display::ImageAlign::TOP_LEFT){
+        align_image(x, y, image->get_width(), image->get_height(), align);
+        append_element<PaletteImageElement>(image, &this->palette, Point2D{x,y});
+    }
+    
+private:
+    static void align_image(int& x, int& y, int width, int height, display::ImageAlign align){
         auto x_align = display::ImageAlign(int(align) & (int(display::ImageAlign::HORIZONTAL_ALIGNMENT)));
         auto y_align = display::ImageAlign(int(align) & (int(display::ImageAlign::VERTICAL_ALIGNMENT)));
         
         switch (x_align) {
         case display::ImageAlign::RIGHT:
-            x -= image->get_width();
+            x -= width;
             break;
         case display::ImageAlign::CENTER_HORIZONTAL:
-            x -= image->get_width() / 2;
+            x -= width / 2;
             break;
         case display::ImageAlign::LEFT:
         default:
@@ -822,27 +2022,181 @@ public:
         
         switch (y_align) {
         case display::ImageAlign::BOTTOM:
-            y -= image->get_height();
+            y -= height;
             break;
         case display::ImageAlign::CENTER_VERTICAL:
-            y -= image->get_height() / 2;
+            y -= height / 2;
             break;
         case display::ImageAlign::TOP:
         default:
             break;
         }
-        append_element<TextureFunction>(
-            Point2D{x,y}, Point2D{image->get_width(), image->get_height()},
-            [image, color_on, color_off](int x, int y)->Color3{
-                return Color3(image->get_pixel(x, y, color_on, color_off));
-            });
     }
-    
-#ifdef USE_QR_CODE
-    void Display::qr_code(int x, int y, qr_code::QrCode *qr_code, Color color_on, int scale) {
-        qr_code->draw(this, x, y, color_on, scale);
+
+    void prepareRender(){
+        if(not indexed){
+            buildIndex();
+        }
+    }
+
+    // Elements crossing row y, bottom to top
+    void paintSpans(int y, SpanSink& sink){
+        for(auto i = index.begin(y), e = index.end(y); i != e; ++i){
+            const auto& entry = els[*i];
+            if(y < entry.bb.tl.y || y > entry.bb.br.y){
+                continue;
+            }
+            sink.setSolid(!entry.dither);
+            this->paintElement(entry.el, entry.bb, y, sink);
+        }
+    }
+
+    // Constructs T in the arena, or on the heap once the arena is full
+    template<typename T, typename... A>
+    Elemental_Owning make(A... e){
+        if(void *mem = arena.allocate(sizeof(T), alignof(T))){
+            return placeElemental<T>(mem, std::forward<A>(e)...);
+        }
+        return makeElemental<T>(std::forward<A>(e)...);
+    }
+
+    void push(Elemental_Owning&& el){
+        els.push_back(Entry{std::move(el), Rect2D{}, ditherNext});
+        els.back().el.fingerprint(fp);
+        fp << ditherNext;
+        this->hasSolid = this->hasSolid || !ditherNext || els.back().el.kind() == ElementKind::PaletteImage;
+        indexed = false;
+    }
+};
+
+// Display list for layouts whose element types are known at build time.
+// Elements are stored by value in a variant of the listed types, so pixAt
+// and spansAt are dispatched statically and can be inlined into the row
+// loop instead of going through the Elemental function table.
+//
+//     StaticScene<Base, RectElement, TextRun> scene;
+//     scene.add<RectElement>(r, esphome::nullopt, Color3{0, 0, 0});
+template<typename Base, typename... Ts>
+class StaticScene: public RowRenderer<Base, StaticScene<Base, Ts...>>{
+    friend class RowRenderer<Base, StaticScene<Base, Ts...>>;
+    using Element = std::variant<Ts...>;
+    // Kept apart from the elements, which are as large as the largest
+    // type: the index walk only touches this
+    struct Slot{
+        Rect2D bb;
+        bool dither;
+    };
+    std::vector<Element> els;
+    std::vector<Slot> slots;
+    SceneIndex<Base::static_width_(), Base::static_height_()> index;
+    bool indexed;
+    bool ditherNext;     // applied to elements added from now on
+public:
+    StaticScene():els(), slots(), index(), indexed(false), ditherNext(true){
+    }
+
+    void set_dithering(bool enabled){
+        ditherNext = enabled;
+    }
+
+    template<typename T, typename... A>
+    T& add(A&&... a){
+        els.emplace_back(std::in_place_type<T>, std::forward<A>(a)...);
+        slots.push_back(Slot{Rect2D{}, ditherNext});
+        this->hasSolid = this->hasSolid || !ditherNext || std::is_same<T, PaletteImageElement>::value;
+        indexed = false;
+        return *std::get_if<T>(&els.back());
+    }
+
+    size_t size() const {
+        return els.size();
+    }
+
+    void buildIndex(){
+        for(size_t i=0; i < els.size(); ++i){
+            slots[i].bb = detail::visit([](const auto& el){ return el.boundingBox(); }, els[i]);
+        }
+        index.build(els.size(), [this](size_t i) -> const Rect2D& { return slots[i].bb; });
+        indexed = true;
+    }
+
+    Color3 pixAt(int x, int y) const{
+        const Point2D p{x, y};
+        const auto at = [x, y](const auto& el){ return el.pixAt(x, y); };
+        if(not indexed){
+            for(const auto& el:detail::reverse(els)){
+                const auto ret = detail::visit(at, el);
+                if(ret.has_value()){
+                    return ret.value();
+                }
+            }
+            return this->bg;
+        }
+        const auto first = index.begin(y);
+        for(auto i = index.end(y); i != first;){
+            const auto n = *--i;
+            if(not slots[n].bb.has(p)){
+                continue;
+            }
+            const auto ret = detail::visit(at, els[n]);
+            if(ret.has_value()){
+                return ret.value();
+            }
+        }
+        return this->bg;
+    }
+
+    void clear(){
+        els.clear();
+        slots.clear();
+        index.clear();
+        indexed = false;
+        ditherNext = true;
+        this->resetRender();
+    }
+
+    uint32_t fingerprint() const {
+        Fingerprint f;
+        for(size_t i=0; i < els.size(); ++i){
+            detail::visit([&f](const auto& el){ el.fingerprint(f); }, els[i]);
+            f << slots[i].dither;
+        }
+        f << this->bg << this->ditherMode;
+        for(uint8_t i=0; i < 3; ++i){
+            f << this->palette[i].color;
+        }
+        return f.value();
+    }
+
+    // Same breakdown as Elements::memoryUsage. The elements live in the
+    // variant storage, so that is their object size, spare slots included.
+    SceneMemory memoryUsage() const {
+        SceneMemory m;
+        for(const auto& el:els){
+            detail::visit([&m](const auto& e){ e.memoryUsage(m); }, el);
+        }
+        m.elementBytes = capacityBytes(els);
+        m.listBytes = capacityBytes(slots) + index.memoryBytes();
+        return m;
+    }
+
+private:
+    void prepareRender(){
+        if(not indexed){
+            buildIndex();
+        }
+    }
+
+    void paintSpans(int y, SpanSink& sink){
+        for(auto i = index.begin(y), e = index.end(y); i != e; ++i){
+            const auto& slot = slots[*i];
+            if(y < slot.bb.tl.y || y > slot.bb.br.y){
+                continue;
+            }
+            sink.setSolid(!slot.dither);
+            detail::visit([this, &slot, y, &sink](const auto& el){ this->paintElement(el, slot.bb, y, sink); }, els[*i]);
+        }
     }
-#endif  // USE_QR_CODE
 };
 
 }  // namespace elements
@@ -0,0 +1,326 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// Bump allocator for the display list. Elements and their vectors are
+// carved from one buffer that is allocated once and released as a whole
+// when the scene is cleared, so rebuilding the scene on every update does
+// not fragment the heap. Requests that do not fit fall back to the heap.
+class Arena{
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t size;      // of buffer
+    size_t capacity;  // requested
+    size_t used;
+    size_t highWater;
+    uint32_t overflows;
+
+    static Arena*& currentSlot(){
+        static Arena* current = nullptr;
+        return current;
+    }
+public:
+    explicit Arena(size_t c=0):buffer(), size(0), capacity(c), used(0), highWater(0), overflows(0){}
+
+    // Takes effect on the next reset(), 0 disables the arena
+    void setCapacity(size_t c){
+        capacity = c;
+    }
+
+    // nullptr when the request does not fit
+    void* allocate(size_t bytes, size_t align){
+        if(!buffer && capacity > 0){
+            buffer.reset(new (std::nothrow) uint8_t[capacity]);
+            size = buffer ? capacity : 0;
+        }
+        if(!buffer){
+            overflows += capacity > 0;
+            return nullptr;
+        }
+        const auto base = reinterpret_cast<uintptr_t>(buffer.get());
+        const size_t start = (base + used + align - 1) / align * align - base;
+        if(start + bytes > size){
+            ++overflows;
+            return nullptr;
+        }
+        used = start + bytes;
+        highWater = std::max(highWater, used);
+        return buffer.get() + start;
+    }
+
+    // Resizes the block at p, of oldBytes, in place. Only the last block
+    // handed out can change size.
+    bool extend(void *p, size_t oldBytes, size_t newBytes){
+        const auto b = buffer.get();
+        if(b == nullptr || static_cast<uint8_t*>(p) + oldBytes != b + used){
+            return false;
+        }
+        const size_t start = static_cast<uint8_t*>(p) - b;
+        if(start + newBytes > size){
+            return false;
+        }
+        used = start + newBytes;
+        highWater = std::max(highWater, used);
+        return true;
+    }
+
+    bool owns(const void *p) const {
+        const auto b = buffer.get();
+        return b != nullptr && p >= b && p < b + size;
+    }
+
+    // Everything allocated so far must have been destroyed
+    void reset(){
+        used = 0;
+        overflows = 0;
+        if(size != capacity){
+            buffer.reset();
+            size = 0;
+        }
+    }
+
+    size_t usedBytes() const {
+        return used;
+    }
+    size_t capacityBytes() const {
+        return capacity;
+    }
+    size_t highWaterBytes() const {
+        return highWater;
+    }
+    // Allocations since the last reset that went to the heap instead
+    uint32_t overflowCount() const {
+        return overflows;
+    }
+
+    // Arena picked up by default constructed ArenaAllocators
+    static Arena* current(){
+        return currentSlot();
+    }
+
+    // Makes an arena current for the lifetime of the scope
+    class Scope{
+        Arena *previous;
+    public:
+        explicit Scope(Arena *a):previous(currentSlot()){
+            currentSlot() = a;
+        }
+        ~Scope(){
+            currentSlot() = previous;
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
+
+// std allocator over an Arena. Freeing arena memory is a no-op, it goes
+// away with Arena::reset(); heap fallbacks are freed normally.
+template<typename T>
+class ArenaAllocator{
+    template<typename U>
+    friend class ArenaAllocator;
+    Arena *arena;
+public:
+    using value_type = T;
+
+    ArenaAllocator():arena(Arena::current()){}
+    explicit ArenaAllocator(Arena *a):arena(a){}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& o):arena(o.arena){}
+
+    T* allocate(size_t n){
+        if(arena != nullptr){
+            if(auto p = arena->allocate(n * sizeof(T), alignof(T))){
+                return static_cast<T*>(p);
+            }
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t){
+        if(arena == nullptr || !arena->owns(p)){
+            ::operator delete(p);
+        }
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& o) const {
+        return arena == o.arena;
+    }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& o) const {
+        return arena != o.arena;
+    }
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Array of plain values in an arena, for containers filled a value at a
+// time while nothing else is allocated, like PixelLayer. It grows in place
+// at the end of the arena in small steps, where a vector would leave each
+// of its old buffers behind, and only moves when something was allocated
+// after it.
+template<typename T>
+class ArenaArray{
+    static_assert(std::is_trivially_copyable<T>::value, "values are moved with memcpy");
+    constexpr static size_t step = 16;
+    Arena *arena;
+    T *items;
+    size_t count;
+    size_t cap;
+public:
+    using value_type = T;
+
+    ArenaArray():arena(Arena::current()), items(nullptr), count(0), cap(0){}
+    ArenaArray(const ArenaArray& o):arena(o.arena), items(nullptr), count(0), cap(0){
+        reserve(o.count);
+        copyFrom(o);
+    }
+    ArenaArray(ArenaArray&& o) noexcept:arena(o.arena), items(o.items), count(o.count), cap(o.cap){
+        o.items = nullptr;
+        o.count = o.cap = 0;
+    }
+    ArenaArray& operator=(const ArenaArray& o){
+        if(this != &o){
+            count = 0;
+            reserve(o.count);
+            copyFrom(o);
+        }
+        return *this;
+    }
+    ArenaArray& operator=(ArenaArray&& o) noexcept{
+        std::swap(arena, o.arena);
+        std::swap(items, o.items);
+        std::swap(count, o.count);
+        std::swap(cap, o.cap);
+        return *this;
+    }
+    ~ArenaArray(){
+        release(items);
+    }
+
+    size_t size() const {
+        return count;
+    }
+    size_t capacity() const {
+        return cap;
+    }
+    bool empty() const {
+        return count == 0;
+    }
+    T* begin(){
+        return items;
+    }
+    T* end(){
+        return items + count;
+    }
+    const T* begin() const {
+        return items;
+    }
+    const T* end() const {
+        return items + count;
+    }
+    T* data(){
+        return items;
+    }
+    const T* data() const {
+        return items;
+    }
+    T& operator[](size_t i){
+        return items[i];
+    }
+    const T& operator[](size_t i) const {
+        return items[i];
+    }
+
+    void insert(size_t i, const T& v){
+        if(count == cap){
+            grow();
+        }
+        std::memmove(items + i + 1, items + i, (count - i) * sizeof(T));
+        items[i] = v;
+        ++count;
+    }
+    void erase(size_t i){
+        std::memmove(items + i, items + i + 1, (count - i - 1) * sizeof(T));
+        --count;
+    }
+    void push_back(const T& v){
+        insert(count, v);
+    }
+    void clear(){
+        count = 0;
+    }
+
+    // Hands spare capacity back, when the array is at the end of the arena
+    void shrinkToFit(){
+        if(items != nullptr && arena != nullptr && arena->extend(items, cap * sizeof(T), count * sizeof(T))){
+            cap = count;
+            if(cap == 0){
+                items = nullptr;
+            }
+        }
+    }
+
+    void reserve(size_t n){
+        if(n <= cap){
+            return;
+        }
+        if(items != nullptr && arena != nullptr && arena->extend(items, cap * sizeof(T), n * sizeof(T))){
+            cap = n;
+            return;
+        }
+        T *p = allocate(n);
+        if(count > 0){
+            std::memcpy(p, items, count * sizeof(T));
+        }
+        release(items);
+        items = p;
+        cap = n;
+    }
+
+private:
+    // In place by a step, otherwise moved to twice the size
+    void grow(){
+        if(items != nullptr && arena != nullptr && arena->extend(items, cap * sizeof(T), (cap + step) * sizeof(T))){
+            cap += step;
+            return;
+        }
+        reserve(std::max(step, cap * 2));
+    }
+
+    void copyFrom(const ArenaArray& o){
+        if(o.count > 0){
+            std::memcpy(items, o.items, o.count * sizeof(T));
+        }
+        count = o.count;
+    }
+
+    T* allocate(size_t n){
+        if(arena != nullptr){
+            if(auto p = arena->allocate(n * sizeof(T), alignof(T))){
+                return static_cast<T*>(p);
+            }
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void release(T *p){
+        if(p != nullptr && (arena == nullptr || !arena->owns(p))){
+            ::operator delete(p);
+        }
+    }
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
@@ -34,17 +34,14 @@ struct AColor3{
         return *this;
     }
     
-    inline bool operator==(const AColor3 &rhs) {  // NOLINT
+    inline bool operator==(const AColor3 &rhs) const {  // NOLINT
         return \
                    this->red == rhs.red &&\
                      this->green == rhs.green &&\
                      this->blue == rhs.blue;
     }
-    inline bool operator!=(const AColor3 &rhs) {  // NOLINT
-        return \
-                   this->red != rhs.red &&\
-                     this->green != rhs.green &&\
-                     this->blue != rhs.blue;
+    inline bool operator!=(const AColor3 &rhs) const {  // NOLINT
+        return !(*this == rhs);
     }
     inline AColor3 operator~() const ESPHOME_ALWAYS_INLINE {
         return AColor3(255 - this->red, 255 - this->green, 255 - this->blue);
@@ -205,6 +202,17 @@ using Color3S = AColor3<int8_t, int16_t>;
 using Color3S_16 = AColor3<int16_t, int32_t>;
 using Color3F = AColor3<float,float>;
 
+// Share of an error diffusion kernel, e * n / 32 in integer math. The shift
+// is biased for negative values so that it rounds towards zero exactly like
+// the float -> int conversion of the float pipeline.
+inline int16_t div32(int32_t v){
+    return (v + ((v >> 31) & 31)) >> 5;
+}
+
+inline Color3S_16 diffuse32(const Color3S_16& e, int n){
+    return Color3S_16(div32(e.red * n), div32(e.green * n), div32(e.blue * n));
+}
+
 // extern Color3 
 TripleColor col2bin(Color3 c);
 Color3 col2pallete(Color3F c);
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+enum class DitherMode: uint8_t{
+    // nearest palette entry, no dithering
+    None,
+    // the original 7/3/5/1 (per 32) kernel, needs one lookahead row
+    ErrorDiffusion,
+    // Atkinson, diffuses 6/8 of the error, needs two lookahead rows
+    Atkinson,
+    // 8x8 Bayer threshold map, stateless: any pixel can be rendered alone
+    Ordered,
+};
+
+// Rows of color buffer a dithering mode keeps alive, the current one included
+inline int ditherRows(DitherMode m){
+    switch(m){
+    case DitherMode::ErrorDiffusion:
+        return 2;
+    case DitherMode::Atkinson:
+        return 3;
+    case DitherMode::None:
+    case DitherMode::Ordered:
+    default:
+        return 1;
+    }
+}
+
+// Ordered dithering offset added to every channel, in [-126, 126]
+inline int16_t bayerOffset(int x, int y){
+    static const uint8_t bayer[8][8] = {
+        { 0, 32,  8, 40,  2, 34, 10, 42},
+        {48, 16, 56, 24, 50, 18, 58, 26},
+        {12, 44,  4, 36, 14, 46,  6, 38},
+        {60, 28, 52, 20, 62, 30, 54, 22},
+        { 3, 35, 11, 43,  1, 33,  9, 41},
+        {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47,  7, 39, 13, 45,  5, 37},
+        {63, 31, 55, 23, 61, 29, 53, 21},
+    };
+    return int16_t(bayer[y & 7][x & 7]) * 4 + 2 - 128;
+}
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
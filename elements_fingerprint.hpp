@@ -0,0 +1,50 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "esphome/core/optional.h"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// FNV-1a over the structure of the display list: element kinds, geometry,
+// colors, glyph and image pointers. Equal fingerprints mean equal frames.
+class Fingerprint{
+    uint32_t h;
+public:
+    Fingerprint():h(2166136261UL){}
+
+    Fingerprint& bytes(const void *data, size_t len){
+        const auto p = static_cast<const uint8_t*>(data);
+        for(size_t i=0; i < len; ++i){
+            h = (h ^ p[i]) * 16777619UL;
+        }
+        return *this;
+    }
+
+    // Plain values only, padding bytes would make the hash unstable
+    template<typename T>
+    Fingerprint& operator<<(const T& v){
+        static_assert(std::is_trivially_copyable<T>::value, "hash members one by one");
+        return bytes(&v, sizeof(v));
+    }
+
+    template<typename T>
+    Fingerprint& operator<<(const esphome::optional<T>& v){
+        *this << v.has_value();
+        if(v.has_value()){
+            *this << v.value();
+        }
+        return *this;
+    }
+
+    uint32_t value() const {
+        return h;
+    }
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
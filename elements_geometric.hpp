@@ -4,6 +4,8 @@
 #include <array>
 #include <algorithm>
 
+#include "elements_math_utils.hpp"
+
 namespace esphome {
 namespace waveshare_epaper {
 namespace elements {
@@ -67,6 +69,24 @@ public:
     int height() const{
         return br.y - tl.y;
     }
+    
+    bool empty() const {
+        return br.x < tl.x || br.y < tl.y;
+    }
+    
+    Rect2D intersect(const Rect2D& o) const {
+        return Rect2D{
+            Point2D{std::max(tl.x, o.tl.x), std::max(tl.y, o.tl.y)},
+            Point2D{std::min(br.x, o.br.x), std::min(br.y, o.br.y)}
+        };
+    }
+    
+    Rect2D unite(const Rect2D& o) const {
+        return Rect2D{
+            Point2D{std::min(tl.x, o.tl.x), std::min(tl.y, o.tl.y)},
+            Point2D{std::max(br.x, o.br.x), std::max(br.y, o.br.y)}
+        };
+    }
 };
 
 class Triangle2D {
@@ -114,6 +134,50 @@ public:
     Rect2D boundingBox() const{
         return bb;
     }
+    
+    // Range of x on row y for which has() is true. Every edge test of has()
+    // is linear in x, so the covered part of a row is a single interval.
+    bool rowSpan(int y, int& x0, int& x1) const {
+        if(y < bb.tl.y || y > bb.br.y){
+            return false;
+        }
+        int posL = bb.tl.x, posR = bb.br.x;
+        int negL = bb.tl.x, negR = bb.br.x;
+        for(size_t i=0; i < v.size(); ++i){
+            const auto& a = v[i];
+            const auto& b = v[(i + 1) % v.size()];
+            // sign(p, a, b) == A * p.x + B
+            const int A = a.y - b.y;
+            const int B = -b.x * A - (a.x - b.x) * (y - b.y);
+            if(A == 0){
+                if(B < 0){
+                    posR = posL - 1;
+                }
+                if(B > 0){
+                    negR = negL - 1;
+                }
+            }else if(A > 0){
+                posL = std::max(posL, ceilDiv(-B, A));
+                negR = std::min(negR, floorDiv(-B, A));
+            }else{
+                posR = std::min(posR, floorDiv(-B, A));
+                negL = std::max(negL, ceilDiv(-B, A));
+            }
+        }
+        // For a proper triangle at most one of the intervals is non-empty,
+        // for a degenerate one both are the same segment.
+        if(posL <= posR){
+            x0 = posL;
+            x1 = posR;
+            return true;
+        }
+        if(negL <= negR){
+            x0 = negL;
+            x1 = negR;
+            return true;
+        }
+        return false;
+    }
 private:
     static int sign(Point2D p1, Point2D p2, Point2D p3)
     {
@@ -0,0 +1,87 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "elements_geometric.hpp"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// Row buckets over the display list. Screen is cut into horizontal bands of
+// BandHeight rows, every band keeps indices of elements whose bounding box
+// crosses it. Indices inside a band are kept in z-order (ascending).
+template<int Width, int Height, int BandHeight=8>
+class SceneIndex{
+public:
+    constexpr static int bandCount = (Height + BandHeight - 1) / BandHeight;
+
+    SceneIndex():offsets{}, indices(){}
+
+    template<typename BoundingBoxes>
+    void build(size_t count, BoundingBoxes&& bbOf){
+        std::fill(std::begin(offsets), std::end(offsets), 0);
+        // counting pass, offsets[b+1] holds element count of band b
+        for(size_t i=0; i < count; ++i){
+            int first, last;
+            if(bands(bbOf(i), first, last)){
+                for(int b=first; b <= last; ++b){
+                    ++offsets[b+1];
+                }
+            }
+        }
+        for(int b=0; b < bandCount; ++b){
+            offsets[b+1] += offsets[b];
+        }
+        indices.resize(offsets[bandCount]);
+        std::array<uint32_t, bandCount> fillPos;
+        std::copy_n(std::begin(offsets), bandCount, std::begin(fillPos));
+        for(size_t i=0; i < count; ++i){
+            int first, last;
+            if(bands(bbOf(i), first, last)){
+                for(int b=first; b <= last; ++b){
+                    indices[fillPos[b]++] = uint16_t(i);
+                }
+            }
+        }
+    }
+
+    const uint16_t* begin(int y) const {
+        return indices.data() + offsets[y / BandHeight];
+    }
+    const uint16_t* end(int y) const {
+        return indices.data() + offsets[y / BandHeight + 1];
+    }
+
+    // Heap held by the buckets
+    size_t memoryBytes() const {
+        return indices.capacity() * sizeof(uint16_t);
+    }
+
+    void clear(){
+        std::fill(std::begin(offsets), std::end(offsets), 0);
+        indices.clear();
+    }
+
+private:
+    static bool bands(const Rect2D& bb, int& first, int& last){
+        if(bb.br.x < 0 || bb.tl.x >= Width || bb.br.y < 0 || bb.tl.y >= Height){
+            return false;
+        }
+        if(bb.br.x < bb.tl.x || bb.br.y < bb.tl.y){
+            return false;
+        }
+        first = std::max(bb.tl.y, 0) / BandHeight;
+        last = std::min(bb.br.y, Height - 1) / BandHeight;
+        return true;
+    }
+
+    std::array<uint32_t, bandCount + 1> offsets;
+    std::vector<uint16_t> indices;
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
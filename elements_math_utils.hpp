@@ -54,6 +54,19 @@ inline static uint8_t esp_div8(UL i, UL scale) {
     return sat8<T, UL>(i / scale);
 }
 
+// Integer division rounding towards negative infinity
+inline int floorDiv(int a, int b){
+    const int q = a / b;
+    if((a % b != 0) && ((a < 0) != (b < 0))){
+        return q - 1;
+    }
+    return q;
+}
+
+// Integer division rounding towards positive infinity
+inline int ceilDiv(int a, int b){
+    return -floorDiv(-a, b);
+}
 
 } // namespace esphome
 } // namespace waveshare_epaper
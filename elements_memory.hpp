@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+enum class ElementKind: uint8_t{
+    Line,
+    Rect,
+    Triangle,
+    Circle,
+    Gradient,
+    Texture,
+    TextureFunction,
+    Image,
+    Bitmap,
+    PaletteImage,
+    Text,
+    Pixels,
+};
+
+constexpr size_t elementKindCount = size_t(ElementKind::Pixels) + 1;
+
+inline const char *elementKindName(ElementKind k){
+    switch(k){
+    case ElementKind::Line:
+        return "line";
+    case ElementKind::Rect:
+        return "rect";
+    case ElementKind::Triangle:
+        return "triangle";
+    case ElementKind::Circle:
+        return "circle";
+    case ElementKind::Gradient:
+        return "gradient";
+    case ElementKind::Texture:
+        return "texture";
+    case ElementKind::TextureFunction:
+        return "texture function";
+    case ElementKind::Image:
+        return "image";
+    case ElementKind::Bitmap:
+        return "bitmap";
+    case ElementKind::PaletteImage:
+        return "palette image";
+    case ElementKind::Text:
+        return "text";
+    case ElementKind::Pixels:
+        return "pixels";
+    default:
+        return "?";
+    }
+}
+
+// Bytes a vector holds, spare capacity included
+template<typename V>
+size_t capacityBytes(const V& v){
+    return v.capacity() * sizeof(typename V::value_type);
+}
+
+// Footprint of a display list. Every element reports its own object and
+// the vectors it owns, wherever they were allocated (arena or heap).
+struct SceneMemory{
+    std::array<uint16_t, elementKindCount> counts;
+    size_t elementBytes; // element objects
+    size_t dataBytes;    // vectors owned by elements: vertexes, runs, pixels...
+    size_t listBytes;    // entries and row index of the list itself
+
+    SceneMemory():counts{}, elementBytes(0), dataBytes(0), listBytes(0){}
+
+    void add(ElementKind k, size_t object, size_t data){
+        ++counts[size_t(k)];
+        elementBytes += object;
+        dataBytes += data;
+    }
+
+    uint16_t count(ElementKind k) const {
+        return counts[size_t(k)];
+    }
+    size_t count() const {
+        size_t n = 0;
+        for(auto c: counts){
+            n += c;
+        }
+        return n;
+    }
+    size_t totalBytes() const {
+        return elementBytes + dataBytes + listBytes;
+    }
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+#include "elements_color3.hpp"
+#include "elements_triplecolor.hpp"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// A palette entry together with its 4-bit panel code
+struct PaletteColor{
+    Color3 color;
+    TripleColor code;
+};
+
+// Panel palette: black, white and the third (yellow or red) ink. Colors are
+// calibrated from display.py, which also generates a PROGMEM lookup table of
+// nearest entries so quantization does not need distance math per pixel.
+class Palette{
+public:
+    constexpr static int lutBits = 5;
+    constexpr static int lutLevels = 1 << lutBits;
+    constexpr static size_t lutSize = lutLevels * lutLevels * lutLevels;
+
+    enum Index: uint8_t{
+        Black = 0,
+        White = 1,
+        Ink = 2,
+    };
+
+    Palette():colors{{
+        {Color3(0, 0, 0), TripleColor{0x00}},
+        {Color3(255, 255, 255), TripleColor{0x03}},
+        {Color3(220, 180, 0), TripleColor{0x04}},
+    }}, lut(nullptr){}
+
+    void set(Color3 black, Color3 white, Color3 ink){
+        colors[Black].color = black;
+        colors[White].color = white;
+        colors[Ink].color = ink;
+    }
+
+    // lutSize entries of palette indices, red major, channels reduced to
+    // lutBits bits. Pass nullptr to compute nearest colors directly.
+    void setLut(const uint8_t *l){
+        lut = l;
+    }
+
+    const PaletteColor& operator[](uint8_t i) const {
+        return colors[i];
+    }
+
+    // Error diffusion pushes values outside of 0..255. Clamping those into
+    // the table picks visibly worse entries, so they take the exact path.
+    const PaletteColor& quantize(const Color3S_16& c) const {
+        if(lut != nullptr && inRange(c.red) && inRange(c.green) && inRange(c.blue)){
+            return colors[progmem_read_byte(lut + lutIndex(c))];
+        }
+        return colors[nearest(c)];
+    }
+
+    // Index of the closest entry. Ties resolve ink, black, white like the
+    // legacy col2pallete.
+    uint8_t nearest(const Color3S_16& c) const;
+
+private:
+    static bool inRange(int16_t v){
+        return uint16_t(v) <= 255;
+    }
+
+    static size_t lutIndex(const Color3S_16& c){
+        constexpr int shift = 8 - lutBits;
+        return (size_t(c.red >> shift) << (2 * lutBits)) | (size_t(c.green >> shift) << lutBits) | size_t(c.blue >> shift);
+    }
+
+    std::array<PaletteColor, 3> colors;
+    const uint8_t *lut;
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
@@ -0,0 +1,82 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+#ifdef IN_EMULATION
+#include <chrono>
+#else
+#include "esphome/core/defines.h"
+#include "esphome/core/hal.h"
+#endif // def IN_EMULATION
+
+#include "elements_memory.hpp"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// CPU cycles on the device, nanoseconds in emulation. Differences of two
+// readings are exact as long as the interval is below 2^32 ticks.
+inline uint32_t cycleCount(){
+#ifdef IN_EMULATION
+    return uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#else
+    return arch_get_cpu_cycle_count();
+#endif // def IN_EMULATION
+}
+
+inline uint32_t cyclesPerMicrosecond(){
+#ifdef IN_EMULATION
+    return 1000;
+#else
+    return arch_get_cpu_freq_hz() / 1000000;
+#endif // def IN_EMULATION
+}
+
+// Work done by the elements of one kind during a frame
+struct KindProfile{
+    uint32_t visits;   // spansAt calls, one per element and row it crosses
+    uint32_t covered;  // pixels of the visited bounding box rows
+    uint64_t cycles;   // spent in spansAt
+};
+
+// Where the rows of a frame spent their time. Stage totals are always
+// kept, they cost a few cycle counter reads per row; the per-kind counters
+// need EPAPER_PROFILE since they are updated for every element of every row.
+struct RenderProfile{
+    uint64_t rasterCycles;  // compositing elements into rows
+    uint64_t ditherCycles;  // quantization, error diffusion and the row callback
+    uint32_t rows;
+#ifdef EPAPER_PROFILE
+    std::array<KindProfile, elementKindCount> kinds;
+#endif // def EPAPER_PROFILE
+
+    RenderProfile(){
+        reset();
+    }
+
+    void reset(){
+        rasterCycles = 0;
+        ditherCycles = 0;
+        rows = 0;
+#ifdef EPAPER_PROFILE
+        kinds.fill(KindProfile{0, 0, 0});
+#endif // def EPAPER_PROFILE
+    }
+
+#ifdef EPAPER_PROFILE
+    // Elements whose bounding box covers an average pixel of the frame
+    float visitsPerPixel(int pixels) const {
+        uint64_t n = 0;
+        for(const auto& k: kinds){
+            n += k.covered;
+        }
+        return pixels > 0 ? float(n) / pixels : 0.f;
+    }
+#endif // def EPAPER_PROFILE
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
@@ -0,0 +1,274 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+
+#include "elements_color3.hpp"
+#include "elements_span.hpp"
+#include "elements_palette.hpp"
+#include "elements_dither.hpp"
+#include "elements_run_cache.hpp"
+#include "elements_profile.hpp"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// Row pipeline shared by the scene containers: paints rows into a ring of
+// lookahead buffers, then quantizes and dithers them one by one. Scene
+// provides prepareRender() and paintSpans(y, sink), the latter composites
+// its elements crossing row y bottom to top.
+template<typename Base, typename Scene>
+class RowRenderer{
+protected:
+    Color3 bg;
+    DitherMode ditherMode;
+    bool hasSolid;       // some element opted out of dithering or paints palette entries
+    // Ring of ditherRows() rows: color with accumulated error, and which
+    // pixels come from elements that opted out of dithering or are palette
+    // entries already (SpanSink::solidPalette)
+    std::unique_ptr<Color3S_16[]> rows;
+    std::unique_ptr<uint8_t[]> solid;
+    int rowCount;
+    int nextRow;
+    RunCache glyphCache;
+    // Image data can change between frames (animations, downloaded
+    // images), so decoded images are only reused within a frame
+    RunCache imageCache;
+    RenderProfile renderProfile;
+#ifdef IN_EMULATION
+    std::unique_ptr<Color3[]> origR;
+#endif//def IN_EMULATION
+public:
+    Palette palette;
+
+    RowRenderer():bg(0,0,0), ditherMode(DitherMode::ErrorDiffusion), hasSolid(false),
+        rows(), solid(), rowCount(0), nextRow(Base::static_height_()), glyphCache(), imageCache(8), renderProfile(){
+    }
+
+    void set_dither_mode(DitherMode m){
+        ditherMode = m;
+    }
+
+    void fill(Color3 bg){
+        this->bg = bg;
+    }
+
+    template<typename F>
+    void render(F&& f){
+        beginRender();
+        while(renderNextRow(f));
+    }
+
+    // Incremental rendering: beginRender() then renderNextRow() until it
+    // returns false. The scene must not change in between.
+    void beginRender(){
+        renderProfile.reset();
+        imageCache.forget();
+        // glyphs stay cached across frames until the cache fills up, then
+        // this frame's glyphs get it
+        if(glyphCache.full()){
+            glyphCache.forget();
+        }
+        scene().prepareRender();
+        allocateRows();
+        for(int y=0; y < rowCount; ++y){
+            paintRow(y);
+        }
+        nextRow = 0;
+    }
+
+    // Emits f(x, y, ...) for every pixel of the next row, returns whether
+    // rows are left
+    template<typename F>
+    bool renderNextRow(F&& f){
+        if(nextRow >= Base::static_height_()){
+            return false;
+        }
+        const uint32_t start = cycleCount();
+        renderRow(nextRow, f);
+        renderProfile.ditherCycles += cycleCount() - start;
+        ++renderProfile.rows;
+        paintRow(nextRow + rowCount);
+        ++nextRow;
+        return nextRow < Base::static_height_();
+    }
+
+    int renderedRows() const {
+        return nextRow;
+    }
+
+    const RunCache& glyphs() const {
+        return glyphCache;
+    }
+    const RunCache& images() const {
+        return imageCache;
+    }
+
+    // Time spent on the frame being rendered, reset by beginRender()
+    const RenderProfile& profile() const {
+        return renderProfile;
+    }
+
+    // Lookahead ring and solid flags, allocated by the first beginRender()
+    size_t rowBufferBytes() const {
+        const size_t pixels = size_t(rowCount) * Base::static_width_();
+        return pixels * sizeof(Color3S_16) + (solid ? pixels : 0);
+    }
+
+protected:
+    // Called by the scene when its elements are cleared
+    void resetRender(){
+        hasSolid = false;
+        nextRow = Base::static_height_();
+    }
+
+    // Paints one element crossing row y, bb is its clipped bounding box
+    template<typename E>
+    void paintElement(const E& el, const Rect2D& bb, int y, SpanSink& sink){
+#ifdef EPAPER_PROFILE
+        auto& k = renderProfile.kinds[size_t(el.kind())];
+        const uint32_t start = cycleCount();
+        el.spansAt(y, sink);
+        k.cycles += cycleCount() - start;
+        ++k.visits;
+        k.covered += std::max(0, std::min(bb.br.x, sink.right()) - std::max(bb.tl.x, sink.left()) + 1);
+#else
+        el.spansAt(y, sink);
+#endif // def EPAPER_PROFILE
+    }
+
+private:
+    Scene& scene(){
+        return static_cast<Scene&>(*this);
+    }
+
+    Color3S_16 *rowAt(int y) const {
+        return rows.get() + (y % rowCount) * Base::static_width_();
+    }
+
+    uint8_t *solidAt(int y) const {
+        return solid ? solid.get() + (y % rowCount) * Base::static_width_() : nullptr;
+    }
+
+    // Row buffers are kept between frames, they are only reallocated when
+    // the dither mode needs a different number of rows
+    void allocateRows(){
+        const int n = ditherRows(ditherMode);
+        const size_t size = n * Base::static_width_();
+        if(n != rowCount){
+            rows.reset(new Color3S_16[size]);
+            solid.reset();
+#ifdef IN_EMULATION
+            origR.reset(new Color3[size]);
+#endif//def IN_EMULATION
+            rowCount = n;
+        }
+        if(hasSolid && !solid){
+            solid.reset(new uint8_t[size]);
+        }
+    }
+
+    // Composites the scene elements crossing row y into its ring slot
+    void paintRow(int y){
+        if(y >= Base::static_height_()){
+            return;
+        }
+        const uint32_t start = cycleCount();
+        const auto row = rowAt(y);
+        std::fill_n(row, Base::static_width_(), Color3S_16(bg));
+        SpanSink sink{row, solidAt(y), Base::static_width_()};
+        sink.setGlyphCache(&glyphCache);
+        sink.setImageCache(&imageCache);
+        if(solid){
+            std::fill_n(solidAt(y), Base::static_width_(), 0);
+        }
+        scene().paintSpans(y, sink);
+        renderProfile.rasterCycles += cycleCount() - start;
+#ifdef IN_EMULATION
+        std::copy_n(row, Base::static_width_(), origR.get() + (y % rowCount) * Base::static_width_());
+#endif//def IN_EMULATION
+    }
+
+    // Quantizes row y, spreading the error into the lookahead rows
+    template<typename F>
+    void renderRow(int y, F& f){
+        constexpr int W = Base::static_width_();
+        const int ahead = std::min(rowCount, Base::static_height_() - y);
+        Color3S_16 *r[3];
+        uint8_t *sr[3];
+        for(int dy=0; dy < ahead; ++dy){
+            r[dy] = rowAt(y + dy);
+            sr[dy] = solidAt(y + dy);
+        }
+        // error share for pixel (x, y + dy), skips solid pixels and the
+        // parts of the kernel outside of the screen
+        const auto add = [&r, &sr, ahead](int dy, int x, const Color3S_16& e){
+            if(dy >= ahead || x < 0 || x >= W || (sr[dy] != nullptr && sr[dy][x])){
+                return;
+            }
+            r[dy][x] += e;
+        };
+        for(int x=0; x < W; ++x){
+            const auto currentPix = r[0][x];
+            const uint8_t solidPix = sr[0] != nullptr ? sr[0][x] : 0;
+            auto emit = [&](const PaletteColor& pallettePix){
+                f(
+                    x
+                    , y
+                    , pallettePix
+#ifdef IN_EMULATION
+                    , Color3(origR[(y % rowCount) * W + x])
+                    , Color3(currentPix)
+#endif//def IN_EMULATION
+                );
+            };
+            if(solidPix >= SpanSink::solidPalette){
+                emit(palette[solidPix - SpanSink::solidPalette]);
+                continue;
+            }
+            if(solidPix || ditherMode == DitherMode::None){
+                emit(palette.quantize(currentPix));
+                continue;
+            }
+            if(ditherMode == DitherMode::Ordered){
+                emit(palette.quantize(currentPix + unb(bayerOffset(x, y))));
+                continue;
+            }
+            const auto& pallettePix = palette.quantize(currentPix);
+#ifdef EPAPER_FLOAT_DITHER
+            const auto quantError = Color3F(currentPix) - unb(Color3F(pallettePix.color));
+            const auto w = [&quantError](int n){ return Color3S_16(quantError * unb<float>(n/32.)); };
+#else
+            const auto quantError = currentPix - unb(Color3S_16(pallettePix.color));
+            const auto w = [&quantError](int n){ return diffuse32(quantError, n); };
+#endif//def EPAPER_FLOAT_DITHER
+            if(ditherMode == DitherMode::Atkinson){
+                const auto e = w(4);
+                add(0, x + 1, e);
+                add(0, x + 2, e);
+                add(1, x - 1, e);
+                add(1, x    , e);
+                add(1, x + 1, e);
+                add(2, x    , e);
+            }else if(x == 0){
+                add(0, x + 1, w(7));
+                add(1, x    , w(7));
+                add(1, x + 1, w(2));
+            }else if(x == W-1){
+                add(1, x - 1, w(7));
+                add(1, x    , w(9));
+            }else {
+                add(0, x + 1, w(7));
+                add(1, x - 1, w(3));
+                add(1, x    , w(5));
+                add(1, x + 1, w(1));
+            }
+            emit(pallettePix);
+        }
+    }
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
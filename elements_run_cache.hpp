@@ -0,0 +1,174 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "esphome/core/optional.h"
+#include "elements_color3.hpp"
+#include "elements_fingerprint.hpp"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// Bitmaps decoded to runs of final colors, one entry per (source, format,
+// fg, bg): glyphs keyed by glyph and bpp, images by data and image type.
+// Dashboards repeat the same few characters and icons, so PROGMEM bits are
+// read and anti-aliasing blended once per bitmap instead of once per pixel
+// of every occurrence. Entries are found through a hash index and never
+// evicted: once capacity is reached new bitmaps are not cached, and callers
+// decode the row they need directly. Evicting would decode a whole bitmap
+// for every row painted as soon as a frame uses more bitmaps than fit.
+class RunCache{
+public:
+    struct Key{
+        const void *source;
+        int format;
+        Color3 fg;
+        esphome::optional<Color3> bg;
+
+        bool operator==(const Key& o) const {
+            return source == o.source && format == o.format && fg == o.fg
+                && bg.has_value() == o.bg.has_value()
+                && (!bg.has_value() || bg.value() == o.bg.value());
+        }
+    };
+
+    // Painted pixels [x0, x1] of a bitmap row, relative to its origin
+    struct Run{
+        int16_t x0;
+        int16_t x1;
+        Color3 c;
+    };
+
+    class Rows{
+        friend class RunCache;
+        std::vector<uint16_t> starts;  // first run of every row, plus end
+        std::vector<Run> runs;
+    public:
+        const Run* begin(int y) const {
+            return runs.data() + starts[y];
+        }
+        const Run* end(int y) const {
+            return runs.data() + starts[y + 1];
+        }
+
+        // Appends pixel x of the row being decoded, transparent pixels
+        // (no value) end the current run
+        void add(int x, const esphome::optional<Color3>& c){
+            if(!c.has_value()){
+                return;
+            }
+            if(runs.size() > starts.back() && runs.back().x1 == x - 1 && runs.back().c == c.value()){
+                runs.back().x1 = int16_t(x);
+                return;
+            }
+            runs.push_back(Run{int16_t(x), int16_t(x), c.value()});
+        }
+        void endRow(){
+            starts.push_back(uint16_t(runs.size()));
+        }
+    };
+
+    explicit RunCache(size_t capacity=256):entries(), slots(), capacity(capacity), hits(0), misses(0){}
+
+    // Cached rows for key, decode(rows) fills them on a miss by calling
+    // add() for the pixels and endRow() after each row. nullptr when key
+    // is not cached and the cache is full.
+    template<typename Decode>
+    const Rows* get(const Key& key, Decode&& decode){
+        const uint32_t h = hash(key);
+        if(!slots.empty()){
+            for(size_t i = h & (slots.size() - 1); slots[i] != emptySlot; i = (i + 1) & (slots.size() - 1)){
+                auto& e = entries[slots[i]];
+                if(e.hash == h && e.key == key){
+                    ++hits;
+                    return &e.rows;
+                }
+            }
+        }
+        ++misses;
+        if(used == capacity){
+            return nullptr;
+        }
+        if(used == entries.size()){
+            entries.emplace_back();
+        }
+        auto& e = entries[used];
+        e.key = key;
+        e.hash = h;
+        e.rows.starts.assign(1, 0);
+        e.rows.runs.clear();
+        decode(e.rows);
+        ++used;
+        index(used - 1);
+        return &e.rows;
+    }
+
+    bool full() const {
+        return used == capacity;
+    }
+
+    void clear(){
+        entries.clear();
+        slots.clear();
+        used = 0;
+    }
+
+    // Drops the cached bitmaps but keeps their buffers for the next ones
+    void forget(){
+        std::fill(slots.begin(), slots.end(), emptySlot);
+        used = 0;
+    }
+
+    uint32_t hitCount() const {
+        return hits;
+    }
+    uint32_t missCount() const {
+        return misses;
+    }
+
+private:
+    struct Entry{
+        Key key;
+        uint32_t hash;
+        Rows rows;
+    };
+    static constexpr uint16_t emptySlot = 0xFFFF;
+
+    static uint32_t hash(const Key& key){
+        Fingerprint fp;
+        fp << key.source << key.format << key.fg << key.bg;
+        return fp.value();
+    }
+
+    // Open addressing over entries[0, used), kept at most half full
+    void index(size_t n){
+        if(2 * used > slots.size()){
+            slots.assign(std::max<size_t>(16, 2 * slots.size()), emptySlot);
+            for(size_t i=0; i < used; ++i){
+                insertSlot(i);
+            }
+            return;
+        }
+        insertSlot(n);
+    }
+    void insertSlot(size_t n){
+        size_t i = entries[n].hash & (slots.size() - 1);
+        while(slots[i] != emptySlot){
+            i = (i + 1) & (slots.size() - 1);
+        }
+        slots[i] = uint16_t(n);
+    }
+
+    std::vector<Entry> entries;  // [0, used) cached, the rest spare buffers
+    std::vector<uint16_t> slots;
+    size_t capacity;
+    size_t used{0};
+    uint32_t hits;
+    uint32_t misses;
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
@@ -0,0 +1,119 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+#include "elements_color3.hpp"
+#include "elements_palette.hpp"
+#include "elements_run_cache.hpp"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace elements {
+
+// Receives covered x-intervals of a single row from elements and composites
+// them into the row buffer. All bounds are inclusive and clipped to the row.
+// When a solid row is given, every written pixel also records whether it
+// came from an element that opted out of dithering.
+class SpanSink{
+public:
+    // Solid flag of a pixel painted with palette entry i by paletteRun()
+    // is solidPalette + i, 1 still means quantize to the nearest entry
+    constexpr static uint8_t solidPalette = 2;
+private:
+    Color3S_16 *row;
+    uint8_t *solid;
+    uint8_t solidValue;
+    int width;
+    RunCache *glyphs;
+    RunCache *images;
+public:
+    SpanSink(Color3S_16 *r, int w):SpanSink(r, nullptr, w){}
+    SpanSink(Color3S_16 *r, uint8_t *s, int w):row(r), solid(s), solidValue(0), width(w), glyphs(nullptr), images(nullptr){}
+
+    // Render context shared by the elements of a frame, may be null
+    void setGlyphCache(RunCache *c){
+        glyphs = c;
+    }
+    RunCache *glyphCache() const {
+        return glyphs;
+    }
+    void setImageCache(RunCache *c){
+        images = c;
+    }
+    RunCache *imageCache() const {
+        return images;
+    }
+
+    // Marks pixels written from now on as taken straight to the palette
+    void setSolid(bool s){
+        solidValue = s ? 1 : 0;
+    }
+
+    int left() const {
+        return 0;
+    }
+    int right() const {
+        return width - 1;
+    }
+
+    // Paints [x0, x1] with a constant color
+    void fill(int x0, int x1, Color3 c){
+        x0 = std::max(x0, left());
+        x1 = std::min(x1, right());
+        if(x0 > x1){
+            return;
+        }
+        std::fill(row + x0, row + x1 + 1, Color3S_16(c));
+        if(solid != nullptr){
+            std::fill(solid + x0, solid + x1 + 1, solidValue);
+        }
+    }
+
+    void put(int x, Color3 c){
+        if(x < left() || x > right()){
+            return;
+        }
+        row[x] = Color3S_16(c);
+        if(solid != nullptr){
+            solid[x] = solidValue;
+        }
+    }
+
+    // Paints [x0, x1] with per-pixel colors, f(x) returns Color3
+    template<typename F>
+    void run(int x0, int x1, F&& f){
+        x0 = std::max(x0, left());
+        x1 = std::min(x1, right());
+        for(int x=x0; x <= x1; ++x){
+            row[x] = Color3S_16(f(x));
+        }
+        if(solid != nullptr && x0 <= x1){
+            std::fill(solid + x0, solid + x1 + 1, solidValue);
+        }
+    }
+
+    // Paints [x0, x1] with entries of p, f(x) returns the index; larger
+    // indices leave the pixel alone. The entries go to the panel as they
+    // are: not quantized again, not dithered and spared the diffusion
+    // error of their neighbours.
+    template<typename F>
+    void paletteRun(int x0, int x1, const Palette& p, F&& f){
+        x0 = std::max(x0, left());
+        x1 = std::min(x1, right());
+        const Color3S_16 colors[3] = {Color3S_16(p[0].color), Color3S_16(p[1].color), Color3S_16(p[2].color)};
+        for(int x=x0; x <= x1; ++x){
+            const uint8_t i = f(x);
+            if(i >= 3){
+                continue;
+            }
+            row[x] = colors[i];
+            if(solid != nullptr){
+                solid[x] = solidPalette + i;
+            }
+        }
+    }
+};
+
+}  // namespace elements
+}  // namespace waveshare_epaper
+}  // namespace esphome
@@ -0,0 +1,301 @@
+// Renders the canned scenes on the host and prints one JSON object per
+// scene and line:
+//
+//   epaper_bench [--frames N] [--scene NAME] [--dither MODE] [--arena BYTES] [--check-arena]
+//                [--check-cache]
+//
+// Every frame clears the display list, runs the scene like a writer lambda,
+// finalizes it and renders all rows, as WaveshareEPaper7P5InC does. Times
+// are averaged over the frames after a warm-up frame. --check-arena fails
+// when a scene built into Elements did not fit the arena, --check-cache
+// when glyphs still had to be decoded after the warm-up frame.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "scenes.hpp"
+
+// The replaced operator new below is malloc based, which GCC mistakes for
+// a mismatch wherever it inlines a delete
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+namespace {
+
+// Heap traffic of the whole process, sampled around each frame
+struct AllocCounter {
+    uint64_t count{0};
+    uint64_t bytes{0};
+} allocs;
+
+}  // namespace
+
+void *operator new(size_t n) {
+    ++allocs.count;
+    allocs.bytes += n;
+    if (void *p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void *operator new[](size_t n) { return operator new(n); }
+void *operator new(size_t n, const std::nothrow_t &) noexcept {
+    ++allocs.count;
+    allocs.bytes += n;
+    return std::malloc(n ? n : 1);
+}
+void *operator new[](size_t n, const std::nothrow_t &t) noexcept { return operator new(n, t); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+using namespace esphome::waveshare_epaper;
+using namespace esphome::waveshare_epaper::emulation;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ms(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+struct Options {
+    int frames{10};
+    const char *scene{nullptr};
+    elements::DitherMode dither{elements::DitherMode::ErrorDiffusion};
+    size_t arena{8192};
+    bool checkArena{false};
+    bool checkCache{false};
+};
+
+struct Result {
+    double frameMs{0}, buildMs{0}, renderMs{0}, rasterMs{0}, ditherMs{0};
+    double visitsPerPixel{0};
+    uint64_t allocations{0}, allocatedBytes{0};
+    size_t elements{0}, listBytes{0}, arenaUsed{0};
+    uint32_t arenaOverflows{0}, checksum{0};
+    uint32_t glyphMisses{0};
+};
+
+constexpr int W = Panel::static_width_();
+constexpr int H = Panel::static_height_();
+
+// FNV-1a over the palette codes, equal for equal frames
+struct FrameHash {
+    uint32_t h{2166136261UL};
+    void operator()(int, int, const elements::PaletteColor &p, elements::Color3, elements::Color3) {
+        h = (h ^ p.code.color) * 16777619UL;
+    }
+};
+
+template<typename Scene, typename Build>
+Result run(Scene &scene, const Options &o, Build &&build) {
+    Result r;
+    for (int frame = 0; frame <= o.frames; ++frame) {
+        const auto a0 = allocs;
+        const uint32_t m0 = scene.glyphs().missCount();
+        const auto t0 = Clock::now();
+        scene.clear();
+        build(scene);
+        const auto t1 = Clock::now();
+        FrameHash hash;
+        scene.render(hash);
+        const auto t2 = Clock::now();
+        const auto a1 = allocs;
+        if (frame == 0) {
+            continue;  // warm-up: row buffers, glyph cache, arena
+        }
+        const auto &p = scene.profile();
+        r.frameMs += ms(t2 - t0);
+        r.buildMs += ms(t1 - t0);
+        r.renderMs += ms(t2 - t1);
+        r.rasterMs += p.rasterCycles / 1e6;
+        r.ditherMs += p.ditherCycles / 1e6;
+        r.visitsPerPixel += p.visitsPerPixel(W * H);
+        r.allocations += a1.count - a0.count;
+        r.allocatedBytes += a1.bytes - a0.bytes;
+        r.checksum = hash.h;
+        r.glyphMisses += scene.glyphs().missCount() - m0;
+    }
+    const double n = o.frames;
+    r.frameMs /= n;
+    r.buildMs /= n;
+    r.renderMs /= n;
+    r.rasterMs /= n;
+    r.ditherMs /= n;
+    r.visitsPerPixel /= n;
+    r.allocations /= o.frames;
+    r.allocatedBytes /= o.frames;
+    r.glyphMisses /= o.frames;
+    return r;
+}
+
+void print(const char *scene, const char *container, const Result &r) {
+    printf("{\"scene\":\"%s\",\"container\":\"%s\",\"elements\":%zu,\"ms_per_frame\":%.3f,\"build_ms\":%.3f,"
+           "\"render_ms\":%.3f,\"raster_ms\":%.3f,\"dither_ms\":%.3f,\"visits_per_pixel\":%.3f,"
+           "\"allocations\":%llu,\"allocated_bytes\":%llu,\"display_list_bytes\":%zu,\"arena_used\":%zu,"
+           "\"arena_overflows\":%u,\"glyph_misses\":%u,\"checksum\":\"%08x\"}\n",
+           scene, container, r.elements, r.frameMs, r.buildMs, r.renderMs, r.rasterMs, r.ditherMs,
+           r.visitsPerPixel, (unsigned long long) r.allocations,
+           (unsigned long long) r.allocatedBytes, r.listBytes, r.arenaUsed, unsigned(r.arenaOverflows),
+           unsigned(r.glyphMisses), unsigned(r.checksum));
+    fflush(stdout);
+}
+
+// Random rects, lines, circles and triangles, built into both containers to
+// compare the type-erased list with static dispatch
+template<typename S, typename Add>
+void shapes(S &it, Add &&add) {
+    it.fill(Color3{255, 255, 255});
+    Random rnd(3);
+    for (int i = 0; i < 200; ++i) {
+        const int x = rnd.range(0, W - 1), y = rnd.range(0, H - 1);
+        const int w = rnd.range(1, 120), h = rnd.range(1, 80);
+        const elements::Color3 c{uint8_t(rnd.next()), uint8_t(rnd.next()), uint8_t(rnd.next())};
+        add(i % 4, x, y, w, h, c);
+    }
+}
+
+bool selected(const Options &o, const char *name) { return o.scene == nullptr || strcmp(o.scene, name) == 0; }
+
+elements::DitherMode parseDither(const char *s) {
+    if (strcmp(s, "none") == 0) {
+        return elements::DitherMode::None;
+    }
+    if (strcmp(s, "atkinson") == 0) {
+        return elements::DitherMode::Atkinson;
+    }
+    if (strcmp(s, "ordered") == 0) {
+        return elements::DitherMode::Ordered;
+    }
+    return elements::DitherMode::ErrorDiffusion;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--check-arena") {
+            o.checkArena = true;
+        } else if (arg == "--check-cache") {
+            o.checkCache = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            o.frames = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--scene" && i + 1 < argc) {
+            o.scene = argv[++i];
+        } else if (arg == "--dither" && i + 1 < argc) {
+            o.dither = parseDither(argv[++i]);
+        } else if (arg == "--arena" && i + 1 < argc) {
+            o.arena = size_t(atol(argv[++i]));
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--frames N] [--scene NAME] [--dither MODE] [--arena BYTES] [--check-arena]"
+                    " [--check-cache]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    static Assets assets;
+    static elements::Elements<Panel> list;
+    list.set_dither_mode(o.dither);
+    list.set_arena_capacity(o.arena);
+    int overflowed = 0;
+    int decoding = 0;
+
+    for (const auto &s : scenes<elements::Elements<Panel>>()) {
+        if (!selected(o, s.name)) {
+            continue;
+        }
+        elements::SceneMemory memory;
+        auto r = run(list, o, [&](elements::Elements<Panel> &it) {
+            s.build(it, assets, W, H);
+            it.finalize();
+            memory = it.memoryUsage();
+        });
+        r.elements = memory.count();
+        r.listBytes = memory.totalBytes();
+        r.arenaUsed = list.memory().usedBytes();
+        r.arenaOverflows = list.memory().overflowCount();
+        print(s.name, "elements", r);
+        overflowed += r.arenaOverflows != 0;
+        decoding += r.glyphMisses != 0;
+    }
+
+    if (selected(o, "shapes")) {
+        elements::SceneMemory memory;
+        auto r = run(list, o, [&](elements::Elements<Panel> &it) {
+            shapes(it, [&it](int kind, int x, int y, int w, int h, elements::Color3 c) {
+                const esphome::Color color(c.red, c.green, c.blue);
+                switch (kind) {
+                    case 0:
+                        it.filled_rectangle(x, y, w, h, color);
+                        break;
+                    case 1:
+                        it.line(x, y, x + w, y + h, color);
+                        break;
+                    case 2:
+                        it.filled_circle(x, y, h / 2, color);
+                        break;
+                    default:
+                        it.filled_triangle(x, y, x + w, y, x, y + h, color);
+                        break;
+                }
+            });
+            it.buildIndex();
+            memory = it.memoryUsage();
+        });
+        r.elements = memory.count();
+        r.listBytes = memory.totalBytes();
+        r.arenaUsed = list.memory().usedBytes();
+        r.arenaOverflows = list.memory().overflowCount();
+        print("shapes", "elements", r);
+        overflowed += r.arenaOverflows != 0;
+
+        using Static = elements::StaticScene<Panel, elements::LineElement, elements::RectElement,
+                                             elements::CircleElement, elements::TriangleElement>;
+        static Static fixed;
+        fixed.set_dither_mode(o.dither);
+        r = run(fixed, o, [&memory](Static &it) {
+            shapes(it, [&it](int kind, int x, int y, int w, int h, elements::Color3 c) {
+                switch (kind) {
+                    case 0:
+                        it.add<elements::RectElement>(Rect2D{Point2D{x, y}, Point2D{x + w - 1, y + h - 1}},
+                                                      esphome::nullopt, c);
+                        break;
+                    case 1:
+                        it.add<elements::LineElement>(c, std::array<Point2D, 2>{Point2D{x, y}, Point2D{x + w, y + h}});
+                        break;
+                    case 2:
+                        it.add<elements::CircleElement>(elements::Circle2D{Point2D{x, y}, float(h / 2)}, c,
+                                                        esphome::display::DRAWING_FILLED);
+                        break;
+                    default:
+                        it.add<elements::TriangleElement>(
+                            elements::Triangle2D{Point2D{x, y}, Point2D{x + w, y}, Point2D{x, y + h}}, c);
+                        break;
+                }
+            });
+            it.buildIndex();
+            memory = it.memoryUsage();
+        });
+        r.elements = memory.count();
+        r.listBytes = memory.totalBytes();
+        print("shapes", "static", r);
+    }
+    if (o.checkArena && overflowed != 0) {
+        fprintf(stderr, "%d scenes did not fit a %zu byte arena\n", overflowed, o.arena);
+        return 1;
+    }
+    if (o.checkCache && decoding != 0) {
+        fprintf(stderr, "%d scenes decoded glyphs after the warm-up frame\n", decoding);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,549 @@
+// Differential tests of the fast paths against their references, on
+// randomized scenes:
+//
+// - row rasterizers (spansAt, via render) against Elements::pixAt, which
+//   composites the per-pixel functions of all elements
+// - the same for finalize(), which merges and drops elements
+// - StaticScene against Elements, for the element types both can hold
+// - the image row decoders against image::Image::get_pixel()
+// - draw_pixels_at, referenced and copied, against Display::draw_pixels_at()
+// - pre-dithered images against their palette entries, in every dither mode
+// - the scene fingerprint of images whose RAM buffer changes in place
+// - draw_pixel_at over drawn pixels against a plain pixel grid, and the
+//   runs left behind by painting an area over in another color
+// - the nearest-ink table built by display.py against Palette::nearest
+//
+// Prints the first mismatches of each check and exits non-zero on any.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "scenes.hpp"
+
+using namespace esphome::waveshare_epaper;
+using namespace esphome::waveshare_epaper::emulation;
+using esphome::Color;
+namespace display = esphome::display;
+namespace image = esphome::image;
+
+namespace {
+
+struct SmallPanel {
+    constexpr static int static_width_() { return 96; }
+    constexpr static int static_height_() { return 64; }
+};
+
+constexpr int W = SmallPanel::static_width_();
+constexpr int H = SmallPanel::static_height_();
+
+class Check {
+    const char *name;
+    long mismatches{0};
+
+public:
+    explicit Check(const char *n) : name(n) {}
+
+    void expect(bool ok, int seed, int x, int y, Color3 got, Color3 want) {
+        if (ok) {
+            return;
+        }
+        if (mismatches < 5) {
+            printf("%s: seed %d at %d,%d: got %d,%d,%d want %d,%d,%d\n", name, seed, x, y, got.red, got.green,
+                   got.blue, want.red, want.green, want.blue);
+        }
+        ++mismatches;
+    }
+    void expect(bool ok, int seed, const char *what) {
+        if (ok) {
+            return;
+        }
+        if (mismatches < 5) {
+            printf("%s: seed %d: %s\n", name, seed, what);
+        }
+        ++mismatches;
+    }
+    bool report() const {
+        printf("%s: %s (%ld mismatches)\n", name, mismatches == 0 ? "ok" : "FAILED", mismatches);
+        return mismatches == 0;
+    }
+};
+
+Color color(Random &rnd) {
+    switch (rnd.range(0, 4)) {
+        case 0:
+            return BLACK;
+        case 1:
+            return WHITE;
+        case 2:
+            return INK;
+        default:
+            return Color(uint8_t(rnd.next()), uint8_t(rnd.next()), uint8_t(rnd.next()));
+    }
+}
+
+// Every kind of element the writer API produces, partly off-screen
+void randomScene(elements::Elements<SmallPanel> &it, const Assets &a, Random &rnd) {
+    it.fill(Color3(color(rnd)));
+    const int n = rnd.range(1, 40);
+    for (int i = 0; i < n; ++i) {
+        const int x = rnd.range(-20, W + 10), y = rnd.range(-20, H + 10);
+        const int x2 = rnd.range(-20, W + 10), y2 = rnd.range(-20, H + 10);
+        const int r = rnd.range(0, 40);
+        const Color c = color(rnd);
+        it.set_dithering(rnd.range(0, 3) != 0);
+        switch (rnd.range(0, 15)) {
+            case 0:
+                it.filled_rectangle(x, y, r + 1, rnd.range(1, 30), c);
+                break;
+            case 1:
+                it.rectangle(x, y, r + 1, rnd.range(1, 30), c);
+                break;
+            case 2:
+                it.line(x, y, x2, y2, c);
+                break;
+            case 3:
+                it.horizontal_line(x, y, r, c);
+                break;
+            case 4:
+                it.circle(x, y, r, c);
+                break;
+            case 5:
+                it.filled_circle(x, y, r, c);
+                break;
+            case 6:
+                it.triangle(x, y, x2, y2, rnd.range(-20, W + 10), rnd.range(-20, H + 10), c);
+                break;
+            case 7:
+                it.filled_triangle(x, y, x2, y2, rnd.range(-20, W + 10), rnd.range(-20, H + 10), c);
+                break;
+            case 8:
+                it.filled_regular_polygon(x, y, r, rnd.range(3, 8), c);
+                break;
+            case 9: {
+                const int bg = rnd.range(0, 2);
+                it.print(x, y, rnd.range(0, 1) ? a.text : a.smooth, c, display::TextAlign::TOP_LEFT, "Ag 12%",
+                         bg == 0 ? CLEAR : esphome::optional<Color>(bg == 1 ? display::COLOR_OFF : color(rnd)));
+                break;
+            }
+            case 10:
+                it.image(x, y, a.icon, c, color(rnd));
+                break;
+            case 11: {
+                image::Image *const images[] = {a.photo, a.gray, a.rgb565, a.rgba};
+                it.image(x, y, images[rnd.range(0, 3)]);
+                break;
+            }
+            case 12:
+                it.template append_element<elements::LinearGradient>(
+                    Rect2D{Point2D{x, y}, Point2D{x + r, y + rnd.range(0, 30)}}, Color3(c), Color3(color(rnd)));
+                break;
+            case 13:
+                it.image(x, y, a.artwork);
+                break;
+            default:
+                for (int p = rnd.range(1, 30); p > 0; --p) {
+                    it.draw_pixel_at(x + rnd.range(-8, 8), y + rnd.range(-8, 8), c);
+                }
+                break;
+        }
+    }
+    it.set_dithering(true);
+}
+
+// The composited rows before dithering must equal pixAt everywhere
+void spansVsPixAt(Check &check, int seed, bool finalize, const Assets &a) {
+    static elements::Elements<SmallPanel> scene;
+    Random rnd(seed);
+    scene.clear();
+    randomScene(scene, a, rnd);
+    if (finalize) {
+        scene.finalize();
+    } else {
+        scene.buildIndex();
+    }
+    scene.set_dither_mode(elements::DitherMode::None);
+    scene.render([&](int x, int y, const elements::PaletteColor &, Color3 orig, Color3) {
+        const auto ref = scene.pixAt(x, y);
+        check.expect(orig == ref, seed, x, y, orig, ref);
+    });
+}
+
+template<typename Add>
+void randomShapes(Random &rnd, Add &&add) {
+    const int n = rnd.range(1, 60);
+    for (int i = 0; i < n; ++i) {
+        const int x = rnd.range(-20, W + 10), y = rnd.range(-20, H + 10);
+        add(rnd.range(0, 3), x, y, rnd.range(1, 50), rnd.range(1, 40), Color3(color(rnd)), rnd.range(0, 3) != 0);
+    }
+}
+
+// Both containers must produce the same panel output and account for the
+// same elements
+void staticVsElements(Check &check, int seed) {
+    static elements::Elements<SmallPanel> list;
+    using Static = elements::StaticScene<SmallPanel, elements::LineElement, elements::RectElement,
+                                         elements::CircleElement, elements::TriangleElement>;
+    static Static fixed;
+    Random a(seed), b(seed);
+    list.clear();
+    fixed.clear();
+    list.fill(Color3(255, 255, 255));
+    fixed.fill(Color3(255, 255, 255));
+    randomShapes(a, [](int kind, int x, int y, int w, int h, Color3 c, bool dither) {
+        const esphome::Color color(c.red, c.green, c.blue);
+        list.set_dithering(dither);
+        switch (kind) {
+            case 0:
+                list.filled_rectangle(x, y, w, h, color);
+                break;
+            case 1:
+                list.line(x, y, x + w, y + h, color);
+                break;
+            case 2:
+                list.filled_circle(x, y, h / 2, color);
+                break;
+            default:
+                list.filled_triangle(x, y, x + w, y, x, y + h, color);
+                break;
+        }
+    });
+    randomShapes(b, [](int kind, int x, int y, int w, int h, Color3 c, bool dither) {
+        fixed.set_dithering(dither);
+        switch (kind) {
+            case 0:
+                fixed.add<elements::RectElement>(Rect2D{Point2D{x, y}, Point2D{x + w - 1, y + h - 1}},
+                                                 esphome::nullopt, c);
+                break;
+            case 1:
+                fixed.add<elements::LineElement>(c, std::array<Point2D, 2>{Point2D{x, y}, Point2D{x + w, y + h}});
+                break;
+            case 2:
+                fixed.add<elements::CircleElement>(elements::Circle2D{Point2D{x, y}, float(h / 2)}, c,
+                                                   esphome::display::DRAWING_FILLED);
+                break;
+            default:
+                fixed.add<elements::TriangleElement>(
+                    elements::Triangle2D{Point2D{x, y}, Point2D{x + w, y}, Point2D{x, y + h}}, c);
+                break;
+        }
+    });
+    list.buildIndex();
+    fixed.buildIndex();
+    const auto listMemory = list.memoryUsage(), fixedMemory = fixed.memoryUsage();
+    check.expect(fixedMemory.counts == listMemory.counts, seed, "StaticScene counts other elements");
+    check.expect(fixedMemory.dataBytes == listMemory.dataBytes, seed, "StaticScene counts other element data");
+    check.expect(fixedMemory.elementBytes >= fixed.size() * sizeof(elements::RectElement), seed,
+                 "StaticScene misses its element storage");
+    static Color3 expected[H][W];
+    list.render([](int x, int y, const elements::PaletteColor &p, Color3, Color3) { expected[y][x] = p.color; });
+    fixed.render([&](int x, int y, const elements::PaletteColor &p, Color3, Color3) {
+        check.expect(p.color == expected[y][x], seed, x, y, p.color, expected[y][x]);
+    });
+}
+
+// Every image type, opaque and transparent, at a few offsets
+void imagesVsGetPixel(Check &check, const Assets &a) {
+    static elements::Elements<SmallPanel> scene;
+    const Color3 bg(10, 20, 30);
+    const Color on(200, 100, 50), off(0, 90, 180);
+    int seed = 0;
+    for (image::Image *img : {a.icon, a.photo, a.gray, a.rgb565, a.rgba}) {
+        const bool wasTransparent = img->has_transparency();
+        for (bool transparent : {false, true}) {
+            img->set_transparency(transparent);
+            for (const Point2D at : {Point2D{0, 0}, Point2D{-5, 7}, Point2D{W - 20, H - 10}}) {
+                ++seed;
+                scene.clear();
+                scene.fill(bg);
+                scene.image(at.x, at.y, img, on, off);
+                scene.set_dither_mode(elements::DitherMode::None);
+                scene.render([&](int x, int y, const elements::PaletteColor &, Color3 orig, Color3) {
+                    const int ix = x - at.x, iy = y - at.y;
+                    Color3 want = bg;
+                    if (ix >= 0 && iy >= 0 && ix < img->get_width() && iy < img->get_height()) {
+                        const Color c = img->get_pixel(ix, iy, on, off);
+                        if (img->get_type() == image::IMAGE_TYPE_BINARY) {
+                            want = c == on || !transparent ? Color3(c) : bg;
+                        } else if (c.w >= 0x80 || (!transparent && img->get_type() != image::IMAGE_TYPE_RGBA)) {
+                            want = Color3(c);
+                        }
+                    }
+                    check.expect(orig == want, seed, x, y, orig, want);
+                });
+            }
+        }
+        img->set_transparency(wasTransparent);
+    }
+}
+
+// Display::draw_pixels_at() as in ESPHome: one to_color() per pixel
+Color sourcePixel(const uint8_t *ptr, int x, int y, int w, display::ColorOrder order, display::ColorBitness bitness,
+                  bool bigEndian, int xOffset, int yOffset, int xPad) {
+    const size_t idx = (yOffset + y) * size_t(xOffset + w + xPad) + xOffset + x;
+    uint32_t v;
+    switch (bitness) {
+        case display::COLOR_BITNESS_565: {
+            const uint8_t *p = ptr + idx * 2;
+            v = bigEndian ? (p[0] << 8) + p[1] : p[0] + (p[1] << 8);
+            break;
+        }
+        case display::COLOR_BITNESS_888: {
+            const uint8_t *p = ptr + idx * 3;
+            v = bigEndian ? (p[0] << 16) + (p[1] << 8) + p[2] : p[0] + (p[1] << 8) + (p[2] << 16);
+            break;
+        }
+        default:
+            v = ptr[idx];
+            break;
+    }
+    return display::ColorUtil::to_color(v, order, bitness);
+}
+
+// Random buffers in every format, with few colors (palette copy) or many
+// (copy of the nearest inks, 2 bits a pixel), referenced or copied; the
+// buffer is scribbled over after the call to catch copies that still read
+// from it
+void bitmapsVsDrawPixels(Check &check, int seed) {
+    static elements::Elements<SmallPanel> scene;
+    Random rnd(seed);
+    const auto bitness = display::ColorBitness(rnd.range(0, 2));
+    const auto order = display::ColorOrder(rnd.range(0, 2));
+    const bool bigEndian = rnd.range(0, 1);
+    const int w = rnd.range(1, 70), h = rnd.range(1, 50);
+    const int xOffset = rnd.range(0, 5), yOffset = rnd.range(0, 5), xPad = rnd.range(0, 5);
+    const int x0 = rnd.range(-20, W - 10), y0 = rnd.range(-20, H - 10);
+    const size_t bytes = elements::BitmapElement::pixelBytes(bitness);
+    std::vector<uint8_t> buffer((yOffset + h) * size_t(xOffset + w + xPad) * bytes);
+    const uint32_t colors = uint32_t(1) << rnd.range(1, 12);
+    std::vector<uint8_t> values(colors * bytes);
+    for (auto &v : values) {
+        v = uint8_t(rnd.next());
+    }
+    for (size_t i = 0; i < buffer.size(); i += bytes) {
+        std::copy_n(&values[(rnd.next() % colors) * bytes], bytes, &buffer[i]);
+    }
+    const bool reference = rnd.range(0, 1);
+    std::vector<Color3> distinct;
+    for (int iy = 0; iy < h && distinct.size() <= 256; ++iy) {
+        for (int ix = 0; ix < w && distinct.size() <= 256; ++ix) {
+            const Color3 c(sourcePixel(buffer.data(), ix, iy, w, order, bitness, bigEndian, xOffset, yOffset, xPad));
+            if (std::find(distinct.begin(), distinct.end(), c) == distinct.end()) {
+                distinct.push_back(c);
+            }
+        }
+    }
+    const bool toInks = !reference && distinct.size() > 256;
+    static Color3 expected[H][W];
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            const int ix = x - x0, iy = y - y0;
+            expected[y][x] = ix >= 0 && iy >= 0 && ix < w && iy < h
+                ? Color3(sourcePixel(buffer.data(), ix, iy, w, order, bitness, bigEndian, xOffset, yOffset, xPad))
+                : Color3(255, 255, 255);
+            if (toInks && ix >= 0 && iy >= 0 && ix < w && iy < h) {
+                const auto &inks = scene.palette;
+                expected[y][x] = inks[inks.nearest(elements::Color3S_16(expected[y][x]))].color;
+            }
+        }
+    }
+    scene.clear();
+    scene.fill(Color3(255, 255, 255));
+    if (reference) {
+        const size_t stride = size_t(xOffset + w + xPad) * bytes;
+        scene.append_element<elements::BitmapElement>(
+            Point2D{x0, y0}, Point2D{w, h}, buffer.data() + yOffset * stride + xOffset * bytes, stride,
+            elements::BitmapElement::Format{order, bitness, bigEndian}, true);
+    } else {
+        scene.draw_pixels_at(x0, y0, w, h, buffer.data(), order, bitness, bigEndian, xOffset, yOffset, xPad);
+        std::fill(buffer.begin(), buffer.end(), 0x5a);
+    }
+    if (toInks) {
+        const size_t copied = scene.memoryUsage().dataBytes;
+        check.expect(copied <= (size_t(w) * 2 + 7) / 8 * h + 64, seed, "many colors copied in more than 2 bits a pixel");
+    }
+    scene.buildIndex();
+    scene.set_dither_mode(elements::DitherMode::None);
+    scene.render([&](int x, int y, const elements::PaletteColor &, Color3 orig, Color3) {
+        check.expect(orig == expected[y][x], seed, x, y, orig, expected[y][x]);
+        const auto p = scene.pixAt(x, y);
+        check.expect(p == expected[y][x], seed, x, y, p, expected[y][x]);
+    });
+}
+
+// Pre-dithered images on top of a random scene must reach the panel as
+// their own palette entries, whatever error the pixels around them carry
+void paletteImagesAsIs(Check &check, int seed, const Assets &a) {
+    static elements::Elements<SmallPanel> scene;
+    Random rnd(seed);
+    scene.clear();
+    randomScene(scene, a, rnd);
+    std::vector<Point2D> at;
+    for (int i = rnd.range(1, 4); i > 0; --i) {
+        at.push_back(Point2D{rnd.range(-20, W - 10), rnd.range(-20, H - 10)});
+        scene.image(at.back().x, at.back().y, a.artwork);
+    }
+    scene.set_dither_mode(elements::DitherMode(seed % 4));
+    scene.render([&](int x, int y, const elements::PaletteColor &p, Color3, Color3) {
+        for (auto i = at.rbegin(); i != at.rend(); ++i) {
+            const int ix = x - i->x, iy = y - i->y;
+            if (ix < 0 || iy < 0 || ix >= a.artwork->get_width() || iy >= a.artwork->get_height()) {
+                continue;
+            }
+            const uint8_t index = a.artwork->index(ix, iy);
+            if (index != elements::PaletteImage::transparent) {
+                const Color3 want = scene.palette[index].color;
+                check.expect(p.color == want, seed, x, y, p.color, want);
+                return;
+            }
+        }
+    });
+}
+
+// Rewriting a pixel of an image in RAM, like online_image does, must
+// change the fingerprint, or update() would skip the frame as unchanged
+void imageFingerprints(Check &check, const Assets &a) {
+    static elements::Elements<SmallPanel> scene;
+    const auto fingerprint = [](image::Image *img) {
+        scene.clear();
+        scene.image(3, 4, img);
+        return scene.fingerprint();
+    };
+    int seed = 0;
+    for (image::Image *img : {a.icon, a.photo, a.gray, a.rgb565, a.rgba}) {
+        ++seed;
+        auto *data = const_cast<uint8_t *>(img->get_data_start());
+        const size_t last = img->get_type() == image::IMAGE_TYPE_BINARY
+            ? size_t(img->get_width() + 7) / 8 * img->get_height() - 1
+            : size_t(img->get_width()) * img->get_height() - 1;
+        const uint32_t before = fingerprint(img);
+        for (const size_t at : {size_t(0), last}) {
+            data[at] ^= 0x10;
+            check.expect(fingerprint(img) != before, seed, "pixel changed, fingerprint did not");
+            data[at] ^= 0x10;
+        }
+        check.expect(fingerprint(img) == before, seed, "same pixels, other fingerprint");
+    }
+}
+
+// Pixels drawn over each other in random order must read back as the last
+// one drawn. Painting an area in one color and then another, pixel by
+// pixel, must leave about a run per row, not one per overdrawn pixel.
+void pixelRuns(Check &check, int seed) {
+    static elements::Elements<SmallPanel> scene;
+    Random rnd(seed);
+    const Color inks[] = {BLACK, WHITE, INK};
+    const int x0 = rnd.range(0, W / 2), y0 = rnd.range(0, H / 2);
+    const int w = rnd.range(1, W - x0), h = rnd.range(1, H - y0);
+    scene.clear();
+    for (const Color &c : {inks[seed % 3], inks[(seed + 1) % 3]}) {
+        for (int y = y0; y < y0 + h; ++y) {
+            for (int x = x0; x < x0 + w; ++x) {
+                scene.draw_pixel_at(x, y, c);
+            }
+        }
+    }
+    // a run per row, in blocks of 16 runs that at most double
+    const size_t runBytes = scene.memoryUsage().dataBytes;
+    check.expect(runBytes <= size_t(std::max(16, 2 * h)) * 16, seed, "painting over left a run per pixel");
+
+    static Color3 expected[H][W];
+    for (auto &row : expected) {
+        std::fill(std::begin(row), std::end(row), Color3(255, 255, 255));
+    }
+    scene.clear();
+    scene.fill(Color3(255, 255, 255));
+    for (int i = rnd.range(1, 3000); i > 0; --i) {
+        const int x = x0 + rnd.range(0, w - 1), y = y0 + rnd.range(0, h - 1);
+        const Color c = inks[rnd.range(0, 2)];
+        scene.draw_pixel_at(x, y, c);
+        expected[y][x] = Color3(c);
+    }
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            const Color3 got = scene.pixAt(x, y);
+            check.expect(got == expected[y][x], seed, x, y, got, expected[y][x]);
+        }
+    }
+}
+
+double distance(Color3 a, Color3 b) {
+    return std::sqrt(double(a.red - b.red) * (a.red - b.red) + double(a.green - b.green) * (a.green - b.green) +
+                     double(a.blue - b.blue) * (a.blue - b.blue));
+}
+
+// Table lookups, as the firmware quantizes, against Palette::nearest. The
+// table answers for the center of the cell a color falls in, so colors
+// close to a decision boundary can get another entry. Allowed: none for
+// the palette entries themselves; any other color may get an entry at most
+// one cell diagonal (8 * sqrt(3)) farther away than its nearest one, the
+// bound the triangle inequality gives through the cell center.
+void lutVsNearest(Check &check) {
+    const Color3 palettes[][3] = {
+        {Color3(0, 0, 0), Color3(255, 255, 255), Color3(220, 180, 0)},
+        {Color3(0, 0, 0), Color3(255, 255, 255), Color3(200, 20, 20)},
+        {Color3(30, 30, 40), Color3(235, 230, 220), Color3(190, 150, 30)},
+    };
+    const double allowed = 256.0 / elements::Palette::lutLevels * std::sqrt(3.0);
+    long differ = 0, total = 0;
+    int seed = 0;
+    for (const auto &colors : palettes) {
+        ++seed;
+        elements::Palette p;
+        p.set(colors[0], colors[1], colors[2]);
+        const auto lut = paletteLut(p);
+        p.setLut(lut.data());
+        for (const Color3 &c : colors) {
+            const auto &got = p.quantize(elements::Color3S_16(c));
+            check.expect(got.color == c, seed, 0, 0, got.color, c);
+        }
+        for (int r = 0; r < 256; r += 3) {
+            for (int g = 0; g < 256; g += 3) {
+                for (int b = 0; b < 256; b += 3) {
+                    const Color3 c(r, g, b);
+                    const elements::Color3S_16 c16(c);
+                    const Color3 got = p.quantize(c16).color, want = p[p.nearest(c16)].color;
+                    ++total;
+                    if (got == want) {
+                        continue;
+                    }
+                    ++differ;
+                    if (distance(c, got) - distance(c, want) > allowed) {
+                        char what[96];
+                        snprintf(what, sizeof(what), "%d,%d,%d gets %d,%d,%d, nearest is %d,%d,%d", r, g, b,
+                                 got.red, got.green, got.blue, want.red, want.green, want.blue);
+                        check.expect(false, seed, what);
+                    }
+                }
+            }
+        }
+    }
+    printf("nearest-ink table: %ld of %ld grid colors get another entry than Palette::nearest\n", differ, total);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    const int runs = argc > 1 ? atoi(argv[1]) : 300;
+    static Assets assets;
+    Check pixAt("spans vs pixAt"), finalized("spans vs pixAt, finalized"), containers("StaticScene vs Elements");
+    for (int seed = 1; seed <= runs; ++seed) {
+        spansVsPixAt(pixAt, seed, false, assets);
+        spansVsPixAt(finalized, seed, true, assets);
+        staticVsElements(containers, seed);
+    }
+    Check images("images vs get_pixel"), bitmaps("draw_pixels_at"), palette("palette images"),
+        fingerprints("image fingerprints"), lut("nearest-ink table"), pixels("draw_pixel_at runs");
+    imagesVsGetPixel(images, assets);
+    imageFingerprints(fingerprints, assets);
+    lutVsNearest(lut);
+    for (int seed = 1; seed <= runs; ++seed) {
+        bitmapsVsDrawPixels(bitmaps, seed);
+        paletteImagesAsIs(palette, seed, assets);
+        pixelRuns(pixels, seed);
+    }
+    const bool ok = pixAt.report() & finalized.report() & containers.report() & images.report() & bitmaps.report()
+        & palette.report() & fingerprints.report() & lut.report() & pixels.report();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+// Renders the canned scenes at a small size and compares the frames with
+// the images checked in under golden/:
+//
+//   epaper_golden --golden DIR --out DIR [--update] [--scene NAME]
+//
+// Three images are kept per scene: the composited scene before dithering
+// (original), the rows as quantized, with the diffused error added
+// (predither), and the panel colors sent out (palette). A mismatch writes
+// the actual image and a diff, with differing pixels in magenta over a
+// faded copy of the golden, to the output directory. --update rewrites
+// the goldens instead.
+//
+// The *_lut cases install the nearest-ink table display.py generates, as
+// the firmware always does; *_calibrated ones also use a measured palette
+// instead of the default one.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "scenes.hpp"
+
+using namespace esphome::waveshare_epaper;
+using namespace esphome::waveshare_epaper::emulation;
+
+namespace {
+
+struct SmallPanel {
+    constexpr static int static_width_() { return 128; }
+    constexpr static int static_height_() { return 64; }
+};
+
+using List = elements::Elements<SmallPanel>;
+
+constexpr int W = SmallPanel::static_width_();
+constexpr int H = SmallPanel::static_height_();
+
+struct Frame {
+    int width{0}, height{0};
+    std::vector<Color3> pixels;
+
+    Frame() = default;
+    Frame(int w, int h) : width(w), height(h), pixels(size_t(w) * h) {}
+    Color3 &at(int x, int y) { return pixels[size_t(y) * width + x]; }
+};
+
+bool writePpm(const std::string &path, const Frame &img) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", img.width, img.height);
+    for (const auto &c : img.pixels) {
+        const uint8_t rgb[3] = {c.red, c.green, c.blue};
+        fwrite(rgb, 1, 3, f);
+    }
+    return fclose(f) == 0;
+}
+
+bool readPpm(const std::string &path, Frame &img) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    int w, h, max;
+    bool ok = fscanf(f, "P6 %d %d %d", &w, &h, &max) == 3 && max == 255 && fgetc(f) != EOF;
+    if (ok) {
+        img = Frame(w, h);
+        for (auto &c : img.pixels) {
+            uint8_t rgb[3];
+            if (fread(rgb, 1, 3, f) != 3) {
+                ok = false;
+                break;
+            }
+            c = Color3{rgb[0], rgb[1], rgb[2]};
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+struct Options {
+    std::string golden{"golden"};
+    std::string out{"."};
+    const char *scene{nullptr};
+    bool update{false};
+};
+
+enum class Inks {
+    Default,            // default palette, exact nearest entry
+    DefaultLut,         // default palette through the table
+    CalibratedLut,      // measured palette through the table
+};
+
+struct Case {
+    std::string name;
+    void (*build)(List &, const Assets &, int, int);
+    elements::DitherMode dither;
+    bool paletteOnly;  // the other two are the same for every dither mode
+    Inks inks;
+};
+
+// Returns the number of pixels that differ from the golden, -1 when it is
+// missing or unreadable
+long compare(const Options &o, const std::string &name, const Frame &actual) {
+    const std::string golden = o.golden + "/" + name + ".ppm";
+    if (o.update) {
+        if (!writePpm(golden, actual)) {
+            printf("%s: cannot write %s\n", name.c_str(), golden.c_str());
+            return -1;
+        }
+        return 0;
+    }
+    Frame expected;
+    if (!readPpm(golden, expected) || expected.width != actual.width || expected.height != actual.height) {
+        printf("%s: missing or bad golden %s\n", name.c_str(), golden.c_str());
+        writePpm(o.out + "/" + name + ".actual.ppm", actual);
+        return -1;
+    }
+    long diff = 0;
+    Frame d(actual.width, actual.height);
+    for (size_t i = 0; i < actual.pixels.size(); ++i) {
+        const auto &e = expected.pixels[i];
+        if (e == actual.pixels[i]) {
+            d.pixels[i] = Color3(uint8_t(e.red / 4 + 191), uint8_t(e.green / 4 + 191), uint8_t(e.blue / 4 + 191));
+        } else {
+            d.pixels[i] = Color3(255, 0, 255);
+            ++diff;
+        }
+    }
+    if (diff != 0) {
+        writePpm(o.out + "/" + name + ".actual.ppm", actual);
+        writePpm(o.out + "/" + name + ".diff.ppm", d);
+    }
+    return diff;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--update") {
+            o.update = true;
+        } else if (arg == "--golden" && i + 1 < argc) {
+            o.golden = argv[++i];
+        } else if (arg == "--out" && i + 1 < argc) {
+            o.out = argv[++i];
+        } else if (arg == "--scene" && i + 1 < argc) {
+            o.scene = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s --golden DIR --out DIR [--update] [--scene NAME]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Case> cases;
+    for (const auto &s : scenes<List>()) {
+        cases.push_back(Case{s.name, s.build, elements::DitherMode::ErrorDiffusion, false, Inks::Default});
+    }
+    cases.push_back(Case{"gradients_atkinson", gradients<List>, elements::DitherMode::Atkinson, true, Inks::Default});
+    cases.push_back(Case{"gradients_ordered", gradients<List>, elements::DitherMode::Ordered, true, Inks::Default});
+    cases.push_back(Case{"gradients_none", gradients<List>, elements::DitherMode::None, true, Inks::Default});
+    cases.push_back(
+        Case{"gradients_lut", gradients<List>, elements::DitherMode::ErrorDiffusion, true, Inks::DefaultLut});
+    cases.push_back(Case{"icons_lut", icons<List>, elements::DitherMode::ErrorDiffusion, true, Inks::DefaultLut});
+    cases.push_back(Case{"gradients_calibrated", gradients<List>, elements::DitherMode::ErrorDiffusion, true,
+                         Inks::CalibratedLut});
+    cases.push_back(
+        Case{"gradients_calibrated_ordered", gradients<List>, elements::DitherMode::Ordered, true, Inks::CalibratedLut});
+
+    elements::Palette defaultInks;
+    const auto defaultLut = paletteLut(defaultInks);
+    elements::Palette calibratedInks;
+    calibratedInks.set(Color3(28, 26, 34), Color3(236, 232, 220), Color3(205, 160, 18));
+    const auto calibratedLut = paletteLut(calibratedInks);
+
+    static Assets assets;
+    static List scene;
+    int failed = 0;
+    for (const auto &c : cases) {
+        if (o.scene != nullptr && c.name != o.scene) {
+            continue;
+        }
+        scene.clear();
+        scene.set_dither_mode(c.dither);
+        scene.palette = c.inks == Inks::CalibratedLut ? calibratedInks : defaultInks;
+        scene.palette.setLut(c.inks == Inks::Default         ? nullptr
+                             : c.inks == Inks::DefaultLut ? defaultLut.data()
+                                                          : calibratedLut.data());
+        c.build(scene, assets, W, H);
+        scene.finalize();
+        Frame original(W, H), predither(W, H), palette(W, H);
+        scene.render([&](int x, int y, const elements::PaletteColor &p, Color3 orig, Color3 quantized) {
+            original.at(x, y) = orig;
+            predither.at(x, y) = quantized;
+            palette.at(x, y) = p.color;
+        });
+        const struct {
+            const char *kind;
+            const Frame &img;
+        } outputs[] = {{"original", original}, {"predither", predither}, {"palette", palette}};
+        for (const auto &out : outputs) {
+            if (c.paletteOnly && &out.img != &palette) {
+                continue;
+            }
+            const std::string name = c.name + "." + out.kind;
+            const long diff = compare(o, name, out.img);
+            if (diff == 0) {
+                printf("%s: %s\n", name.c_str(), o.update ? "updated" : "ok");
+            } else {
+                if (diff > 0) {
+                    printf("%s: %ld of %d pixels differ, see %s/%s.diff.ppm\n", name.c_str(), diff, W * H,
+                           o.out.c_str(), name.c_str());
+                }
+                ++failed;
+            }
+        }
+    }
+    if (failed != 0) {
+        printf("%d images differ; if the change is intended, rerun with --update\n", failed);
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+#pragma once
+// Canned scenes for the host benchmark and tests. Every scene draws through
+// the same writer API as a display lambda and scales to the panel size.
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "elements.hpp"
+
+namespace esphome {
+namespace waveshare_epaper {
+namespace emulation {
+
+using elements::Color3;
+using elements::Point2D;
+using elements::Rect2D;
+
+// Same geometry as the 7.5in (C) panel
+struct Panel {
+    constexpr static int static_width_() { return 640; }
+    constexpr static int static_height_() { return 384; }
+};
+
+// xorshift32, the same sequence on every host
+class Random {
+    uint32_t state;
+public:
+    explicit Random(uint32_t seed) : state(seed ? seed : 1) {}
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    int range(int lo, int hi) { return lo + int(next() % uint32_t(hi - lo + 1)); }
+};
+
+// The table display.py generates with palette_lut(): the nearest entry to
+// the center of every cell of the reduced RGB cube, red major
+inline std::vector<uint8_t> paletteLut(const elements::Palette &p) {
+    using elements::Palette;
+    constexpr int step = 256 / Palette::lutLevels;
+    std::vector<uint8_t> lut;
+    lut.reserve(Palette::lutSize);
+    for (int r = 0; r < Palette::lutLevels; ++r) {
+        for (int g = 0; g < Palette::lutLevels; ++g) {
+            for (int b = 0; b < Palette::lutLevels; ++b) {
+                lut.push_back(p.nearest(elements::Color3S_16(r * step + step / 2, g * step + step / 2,
+                                                             b * step + step / 2)));
+            }
+        }
+    }
+    return lut;
+}
+
+// Synthetic fonts and images: deterministic, so rendered frames can be
+// compared bit for bit between runs and machines
+class Assets {
+public:
+    Assets() {
+        for (int c = 32; c < 127; ++c) {
+            chars_.push_back(uint8_t(c));
+            chars_.push_back(0);
+        }
+        makeFont(textBits_, textGlyphs_, 16, 1, 1);
+        makeFont(smoothBits_, smoothGlyphs_, 24, 4, 2);
+        makeIcon();
+        makePhoto();
+        makeShaded();
+        makeArtwork();
+        text = new font::Font(textGlyphs_.data(), int(textGlyphs_.size()), 13, 16, 1);
+        smooth = new font::Font(smoothGlyphs_.data(), int(smoothGlyphs_.size()), 19, 24, 4);
+        icon = new image::Image(iconBits_.data(), 32, 32, image::IMAGE_TYPE_BINARY);
+        photo = new image::Image(photoBits_.data(), 64, 48, image::IMAGE_TYPE_RGB24);
+        gray = new image::Image(grayBits_.data(), 32, 32, image::IMAGE_TYPE_GRAYSCALE);
+        gray->set_transparency(true);
+        rgb565 = new image::Image(rgb565Bits_.data(), 48, 32, image::IMAGE_TYPE_RGB565);
+        rgba = new image::Image(rgbaBits_.data(), 32, 32, image::IMAGE_TYPE_RGBA);
+        artwork = new elements::PaletteImage(artworkBits_.data(), 45, 30);
+    }
+    ~Assets() {
+        delete text;
+        delete smooth;
+        delete icon;
+        delete photo;
+        delete gray;
+        delete rgb565;
+        delete rgba;
+        delete artwork;
+    }
+    Assets(const Assets &) = delete;
+    Assets &operator=(const Assets &) = delete;
+
+    font::Font *text;    // 1 bpp, 16 px
+    font::Font *smooth;  // 4 bpp anti-aliased, 24 px
+    image::Image *icon;  // 32x32 binary
+    image::Image *photo; // 64x48 RGB24
+    image::Image *gray;  // 32x32 anti-aliased ring, transparent outside
+    image::Image *rgb565;  // 48x32
+    image::Image *rgba;  // 32x32 disc fading out
+    elements::PaletteImage *artwork;  // 45x30 pre-dithered badge, transparent corners
+
+private:
+    // Printable ASCII, glyphs are noisy blocks with a solid frame
+    void makeFont(std::vector<uint8_t> &bits, std::vector<font::GlyphData> &glyphs, int height, int bpp,
+                  uint32_t seed) {
+        Random rnd(seed);
+        const int count = int(chars_.size() / 2);
+        std::vector<size_t> starts;
+        for (int i = 0; i < count; ++i) {
+            const int w = rnd.range(height / 3, height * 2 / 3);
+            const int h = rnd.range(height / 2, height - 2);
+            starts.push_back(bits.size());
+            bits.resize(bits.size() + (size_t(w) * h * bpp + 7) / 8, 0);
+            uint8_t *data = bits.data() + starts.back();
+            int bitpos = 0;
+            for (int y = 0; y < h; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    const bool edge = x == 0 || y == 0 || x == w - 1 || y == h - 1;
+                    const uint32_t v = edge ? (1u << bpp) - 1 : rnd.next() % (1u << bpp);
+                    for (int b = bpp - 1; b >= 0; --b, ++bitpos) {
+                        if (v & (1u << b)) {
+                            data[bitpos >> 3] |= 0x80 >> (bitpos & 7);
+                        }
+                    }
+                }
+            }
+            glyphs.push_back(font::GlyphData{&chars_[i * 2], nullptr, 1, height - h - 1, w, h});
+        }
+        // bits is final now, point the glyphs into it
+        for (int i = 0; i < count; ++i) {
+            glyphs[i].data = bits.data() + starts[i];
+        }
+    }
+
+    void makeIcon() {
+        iconBits_.assign(32 * 32 / 8, 0);
+        for (int y = 0; y < 32; ++y) {
+            for (int x = 0; x < 32; ++x) {
+                const int dx = x - 16, dy = y - 16;
+                const int d = dx * dx + dy * dy;
+                if ((d < 14 * 14 && d > 9 * 9) || (std::abs(dx) < 3 && std::abs(dy) < 8)) {
+                    iconBits_[(y * 32 + x) / 8] |= 0x80 >> (x % 8);
+                }
+            }
+        }
+    }
+
+    void makePhoto() {
+        photoBits_.resize(64 * 48 * 3);
+        for (int y = 0; y < 48; ++y) {
+            for (int x = 0; x < 64; ++x) {
+                uint8_t *p = &photoBits_[(y * 64 + x) * 3];
+                p[0] = uint8_t(x * 4);
+                p[1] = uint8_t(y * 5);
+                p[2] = uint8_t(128 + 127 * std::sin(x * 0.2f + y * 0.1f));
+            }
+        }
+    }
+
+    void makeShaded() {
+        grayBits_.resize(32 * 32);
+        rgbaBits_.resize(32 * 32 * 4);
+        for (int y = 0; y < 32; ++y) {
+            for (int x = 0; x < 32; ++x) {
+                const float d = std::hypot(x - 15.5f, y - 15.5f);
+                const float ring = std::fabs(d - 11) / 4;
+                // 1 is the transparent gray level
+                grayBits_[y * 32 + x] = ring < 1 ? uint8_t(255 * ring) : 1;
+                uint8_t *p = &rgbaBits_[(y * 32 + x) * 4];
+                p[0] = uint8_t(x * 8);
+                p[1] = 40;
+                p[2] = uint8_t(255 - y * 8);
+                p[3] = uint8_t(std::max(0.f, 255 - d * 16));
+            }
+        }
+        rgb565Bits_.resize(48 * 32 * 2);
+        for (int y = 0; y < 32; ++y) {
+            for (int x = 0; x < 48; ++x) {
+                const uint16_t v = uint16_t((x * 31 / 47) << 11 | (y * 63 / 31) << 5 | ((x + y) & 31));
+                rgb565Bits_[(y * 48 + x) * 2] = uint8_t(v >> 8);
+                rgb565Bits_[(y * 48 + x) * 2 + 1] = uint8_t(v);
+            }
+        }
+    }
+
+    // Like display.py output: an ink disc with a black rim, its lower half
+    // shaded by a black and white checkerboard. The odd width pads rows.
+    void makeArtwork() {
+        const int w = 45, h = 30, stride = (w + 3) / 4;
+        artworkBits_.assign(stride * h, 0);
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                const float d = std::hypot((x - 22) / 22.5f, (y - 14.5f) / 15.f);
+                uint8_t i = elements::PaletteImage::transparent;
+                if (d < 0.85f) {
+                    i = y < h / 2 ? elements::Palette::Ink : uint8_t((x + y) % 2);
+                } else if (d < 1) {
+                    i = elements::Palette::Black;
+                }
+                artworkBits_[y * stride + x / 4] |= i << (6 - 2 * (x % 4));
+            }
+        }
+    }
+
+    std::vector<uint8_t> chars_;  // NUL terminated characters of the glyphs
+    std::vector<uint8_t> textBits_, smoothBits_, iconBits_, photoBits_, grayBits_, rgb565Bits_, rgbaBits_,
+        artworkBits_;
+    std::vector<font::GlyphData> textGlyphs_, smoothGlyphs_;
+};
+
+const Color BLACK(0, 0, 0);
+const Color WHITE(255, 255, 255);
+const Color INK(220, 180, 0);
+// Text background: print() fills the text box black unless given nullopt
+const esphome::optional<Color> CLEAR = esphome::nullopt;
+
+// Text-heavy status page: header bar, two columns of readings, footer
+template<typename E>
+void dashboard(E &it, const Assets &a, int w, int h) {
+    it.fill(Color3{255, 255, 255});
+    it.filled_rectangle(0, 0, w, h / 8, BLACK);
+    it.print(w / 2, h / 16, a.smooth, WHITE, display::TextAlign::CENTER, "Living Room 21:45");
+    it.set_dithering(false);
+    char line[48];
+    for (int row = 0; row < 10; ++row) {
+        const int y = h / 8 + 4 + row * (h * 3 / 4) / 10;
+        snprintf(line, sizeof(line), "Sensor %02d  %5.1f C  %3d%%", row, 18.5 + row * 0.7, 40 + row * 3);
+        it.print(4, y, a.text, BLACK, display::TextAlign::TOP_LEFT, line, CLEAR);
+        snprintf(line, sizeof(line), "Power %4d W", 120 * row + 35);
+        it.print(w / 2 + 4, y, a.text, row % 3 == 0 ? INK : BLACK, display::TextAlign::TOP_LEFT, line, CLEAR);
+        it.horizontal_line(0, y + (h * 3 / 4) / 10 - 2, w, BLACK);
+    }
+    it.set_dithering(true);
+    it.vertical_line(w / 2, h / 8, h * 3 / 4, BLACK);
+    it.filled_rectangle(0, h - h / 8, w, h / 8, INK);
+    it.print(4, h - 4, a.smooth, BLACK, display::TextAlign::BOTTOM_LEFT, "Updated 21:45:03", CLEAR);
+}
+
+// Full-screen gradient bands with crisp labels on top
+template<typename E>
+void gradients(E &it, const Assets &a, int w, int h) {
+    it.fill(Color3{255, 255, 255});
+    const Color3 stops[] = {Color3{0, 0, 0}, Color3{255, 255, 255}, Color3{220, 180, 0}, Color3{128, 64, 32},
+                            Color3{40, 120, 200}};
+    const int bands = 6;
+    for (int i = 0; i < bands; ++i) {
+        const Rect2D r{Point2D{0, i * h / bands}, Point2D{w - 1, (i + 1) * h / bands - 1}};
+        it.template append_element<elements::LinearGradient>(r, stops[i % 5], stops[(i + 2) % 5]);
+    }
+    it.set_dithering(false);
+    for (int i = 0; i < bands; ++i) {
+        it.print(8, i * h / bands + 4, a.text, BLACK, display::TextAlign::TOP_LEFT, "gradient band", CLEAR);
+    }
+    it.set_dithering(true);
+}
+
+// Grid of repeated icons plus a few photos
+template<typename E>
+void icons(E &it, const Assets &a, int w, int h) {
+    it.fill(Color3{255, 255, 255});
+    const int cols = std::max(1, w / 48);
+    const int rows = std::max(1, h / 48);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            if ((r + c) % 5 == 4) {
+                continue;
+            }
+            it.image(c * 48 + 8, r * 48 + 8, a.icon, (r + c) % 3 == 0 ? INK : BLACK, WHITE);
+        }
+    }
+    it.image(w - 64 - 8, 8, a.photo);
+    it.image(8, h - 48 - 8, a.photo);
+    it.image(w / 2, h / 2, a.gray, display::ImageAlign::CENTER);
+    it.image(w / 2 - 40, h / 2, a.rgb565, display::ImageAlign::CENTER);
+    it.image(w / 2 + 40, h / 2, a.rgba, display::ImageAlign::CENTER);
+}
+
+// Outlined and filled polygons, circles, triangles and a line fan
+template<typename E>
+void polygons(E &it, const Assets &, int w, int h) {
+    it.fill(Color3{255, 255, 255});
+    const int r = std::min(w, h) / 8;
+    for (int i = 0; i < 8; ++i) {
+        const int cx = (i % 4) * w / 4 + w / 8;
+        const int cy = (i / 4) * h / 2 + h / 4;
+        const Color c = i % 2 ? BLACK : INK;
+        if (i % 3 == 0) {
+            it.filled_regular_polygon(cx, cy, r, 3 + i, c);
+        } else if (i % 3 == 1) {
+            it.regular_polygon(cx, cy, r, 3 + i, display::VARIATION_FLAT_TOP, c);
+            it.filled_circle(cx, cy, r / 2, c);
+        } else {
+            it.circle(cx, cy, r, c);
+            it.filled_triangle(cx - r / 2, cy + r / 2, cx + r / 2, cy + r / 2, cx, cy - r / 2, c);
+        }
+    }
+    for (int i = 0; i <= 16; ++i) {
+        it.line(w / 2, h - 1, i * (w - 1) / 16, 0, i % 2 ? BLACK : INK);
+    }
+    it.rectangle(0, 0, w, h, BLACK);
+}
+
+// Scatter plots drawn one pixel at a time, like a history graph lambda
+template<typename E>
+void plots(E &it, const Assets &a, int w, int h) {
+    it.fill(Color3{255, 255, 255});
+    it.horizontal_line(0, h / 2, w, BLACK);
+    it.vertical_line(w / 10, 0, h, BLACK);
+    for (int x = w / 10; x < w; ++x) {
+        const float t = float(x) / w * 6.2831853f * 3;
+        it.draw_pixel_at(x, h / 2 - int(std::sin(t) * h / 3), BLACK);
+        it.draw_pixel_at(x, h / 2 - int(std::cos(t * 0.7f) * h / 4), INK);
+        it.draw_pixel_at(x, h / 2 - int(std::sin(t * 1.3f) * std::cos(t) * h / 5), BLACK);
+    }
+    Random rnd(7);
+    for (int i = 0; i < w; ++i) {
+        it.draw_pixel_at(rnd.range(w / 10, w - 1), rnd.range(0, h - 1), INK);
+    }
+    it.print(w - 4, 4, a.text, BLACK, display::TextAlign::TOP_RIGHT, "history", CLEAR);
+}
+
+// Pre-dithered artwork over a dithered gradient
+template<typename E>
+void artwork(E &it, const Assets &a, int w, int h) {
+    it.fill(Color3{255, 255, 255});
+    it.template append_element<elements::LinearGradient>(Rect2D{Point2D{0, 0}, Point2D{w - 1, h - 1}},
+                                                          Color3{40, 120, 200}, Color3{220, 180, 0});
+    const int cols = std::max(1, w / 56);
+    const int rows = std::max(1, h / 40);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            it.image(c * 56 + 28, r * 40 + 20, a.artwork, display::ImageAlign::CENTER);
+        }
+    }
+    it.print(w - 4, h - 4, a.text, BLACK, display::TextAlign::BOTTOM_RIGHT, "artwork", CLEAR);
+}
+
+// Paragraphs in the anti-aliased font using every printable character,
+// more distinct glyphs than a small glyph cache would hold
+template<typename E>
+void text(E &it, const Assets &a, int w, int h) {
+    it.fill(Color3{255, 255, 255});
+    char line[65];
+    for (int row = 0; row < 14; ++row) {
+        for (int i = 0; i < 64; ++i) {
+            line[i] = char(32 + (row * 7 + i) % 95);
+        }
+        line[64] = 0;
+        it.print(4, 4 + row * h / 14, a.smooth, row % 4 == 3 ? INK : BLACK, display::TextAlign::TOP_LEFT, line,
+                 CLEAR);
+    }
+}
+
+template<typename E>
+struct Scene {
+    const char *name;
+    void (*build)(E &it, const Assets &a, int w, int h);
+};
+
+template<typename E>
+std::array<Scene<E>, 7> scenes() {
+    return {{
+        {"dashboard", dashboard<E>},
+        {"gradients", gradients<E>},
+        {"icons", icons<E>},
+        {"polygons", polygons<E>},
+        {"plots", plots<E>},
+        {"artwork", artwork<E>},
+        {"text", text<E>},
+    }};
+}
+
+}  // namespace emulation
+}  // namespace waveshare_epaper
+}  // namespace esphome
@@ -0,0 +1,139 @@
+#pragma once
+// Host stand-in for the display types the elements use
+#include "esphome/core/color.h"
+#include "esphome/core/time.h"
+
+namespace esphome {
+namespace display {
+
+static const Color COLOR_OFF(0, 0, 0, 0);
+static const Color COLOR_ON(255, 255, 255, 255);
+
+enum class TextAlign {
+    TOP = 0x00,
+    CENTER_VERTICAL = 0x01,
+    BASELINE = 0x02,
+    BOTTOM = 0x04,
+
+    LEFT = 0x00,
+    CENTER_HORIZONTAL = 0x08,
+    RIGHT = 0x10,
+
+    TOP_LEFT = TOP | LEFT,
+    TOP_CENTER = TOP | CENTER_HORIZONTAL,
+    TOP_RIGHT = TOP | RIGHT,
+    CENTER_LEFT = CENTER_VERTICAL | LEFT,
+    CENTER = CENTER_VERTICAL | CENTER_HORIZONTAL,
+    CENTER_RIGHT = CENTER_VERTICAL | RIGHT,
+    BASELINE_LEFT = BASELINE | LEFT,
+    BASELINE_CENTER = BASELINE | CENTER_HORIZONTAL,
+    BASELINE_RIGHT = BASELINE | RIGHT,
+    BOTTOM_LEFT = BOTTOM | LEFT,
+    BOTTOM_CENTER = BOTTOM | CENTER_HORIZONTAL,
+    BOTTOM_RIGHT = BOTTOM | RIGHT,
+};
+
+enum class ImageAlign {
+    TOP = 0x00,
+    CENTER_VERTICAL = 0x01,
+    BOTTOM = 0x02,
+
+    LEFT = 0x00,
+    CENTER_HORIZONTAL = 0x04,
+    RIGHT = 0x08,
+
+    TOP_LEFT = TOP | LEFT,
+    TOP_CENTER = TOP | CENTER_HORIZONTAL,
+    TOP_RIGHT = TOP | RIGHT,
+    CENTER_LEFT = CENTER_VERTICAL | LEFT,
+    CENTER = CENTER_VERTICAL | CENTER_HORIZONTAL,
+    CENTER_RIGHT = CENTER_VERTICAL | RIGHT,
+    BOTTOM_LEFT = BOTTOM | LEFT,
+    BOTTOM_CENTER = BOTTOM | CENTER_HORIZONTAL,
+    BOTTOM_RIGHT = BOTTOM | RIGHT,
+
+    HORIZONTAL_ALIGNMENT = LEFT | CENTER_HORIZONTAL | RIGHT,
+    VERTICAL_ALIGNMENT = TOP | CENTER_VERTICAL | BOTTOM,
+};
+
+enum RegularPolygonVariation {
+    VARIATION_POINTY_TOP = 0,
+    VARIATION_FLAT_TOP = 1,
+};
+
+enum RegularPolygonDrawing {
+    DRAWING_OUTLINE = 0,
+    DRAWING_FILLED = 1,
+};
+
+enum RegularPolygonRotation : int {
+    ROTATION_0_DEGREES = 0,
+    ROTATION_90_DEGREES = 90,
+    ROTATION_180_DEGREES = 180,
+    ROTATION_270_DEGREES = 270,
+};
+
+enum ColorOrder : uint8_t {
+    COLOR_ORDER_RGB = 0,
+    COLOR_ORDER_BGR = 1,
+    COLOR_ORDER_GRB = 2,
+};
+
+enum ColorBitness : uint8_t {
+    COLOR_BITNESS_888 = 0,
+    COLOR_BITNESS_565 = 1,
+    COLOR_BITNESS_332 = 2,
+};
+
+inline uint8_t esp_scale(uint8_t i, uint8_t scale, uint8_t max_value = 255) { return (max_value * i / scale); }
+
+class ColorUtil {
+public:
+    static Color to_color(uint32_t colorcode, ColorOrder color_order,
+                          ColorBitness color_bitness = COLOR_BITNESS_888, bool right_bit_aligned = true) {
+        int first_bits = 8;
+        int second_bits = 8;
+        int third_bits = 8;
+        switch (color_bitness) {
+            case COLOR_BITNESS_888:
+                break;
+            case COLOR_BITNESS_565:
+                first_bits = 5;
+                second_bits = 6;
+                third_bits = 5;
+                break;
+            case COLOR_BITNESS_332:
+                first_bits = 3;
+                second_bits = 3;
+                third_bits = 2;
+                break;
+        }
+        const uint8_t first = esp_scale((colorcode >> (second_bits + third_bits)) & ((1 << first_bits) - 1),
+                                        (1 << first_bits) - 1);
+        const uint8_t second = esp_scale((colorcode >> third_bits) & ((1 << second_bits) - 1),
+                                         (1 << second_bits) - 1);
+        const uint8_t third = esp_scale(colorcode & ((1 << third_bits) - 1), (1 << third_bits) - 1);
+        Color c;
+        switch (color_order) {
+            case COLOR_ORDER_RGB:
+                c.r = first;
+                c.g = second;
+                c.b = third;
+                break;
+            case COLOR_ORDER_BGR:
+                c.b = first;
+                c.g = second;
+                c.r = third;
+                break;
+            case COLOR_ORDER_GRB:
+                c.g = first;
+                c.r = second;
+                c.b = third;
+                break;
+        }
+        return c;
+    }
+};
+
+}  // namespace display
+}  // namespace esphome
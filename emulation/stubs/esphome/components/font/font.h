@@ -0,0 +1,67 @@
+#pragma once
+// Host stand-in for esphome/components/font/font.h: glyph bitmaps are
+// width * height * bpp bits, MSB first, rows packed back to back.
+#include <cstring>
+#include <vector>
+
+#include "esphome/core/color.h"
+
+namespace esphome {
+namespace font {
+
+struct GlyphData {
+    const uint8_t *a_char;
+    const uint8_t *data;
+    int offset_x;
+    int offset_y;
+    int width;
+    int height;
+};
+
+class Glyph {
+public:
+    Glyph(const GlyphData *data) : glyph_data_(data) {}
+
+    const GlyphData *get_glyph_data() const { return glyph_data_; }
+
+protected:
+    const GlyphData *glyph_data_;
+};
+
+class Font {
+public:
+    Font(const GlyphData *data, int data_nr, int baseline, int height, uint8_t bpp = 1)
+        : baseline_(baseline), height_(height), bpp_(bpp) {
+        glyphs_.reserve(data_nr);
+        for (int i = 0; i < data_nr; i++) {
+            glyphs_.emplace_back(&data[i]);
+        }
+    }
+
+    int match_next_glyph(const uint8_t *str, int *match_length) {
+        for (size_t i = 0; i < glyphs_.size(); i++) {
+            const auto *c = reinterpret_cast<const char *>(glyphs_[i].get_glyph_data()->a_char);
+            const size_t length = strlen(c);
+            if (strncmp(reinterpret_cast<const char *>(str), c, length) == 0) {
+                *match_length = int(length);
+                return int(i);
+            }
+        }
+        *match_length = 1;
+        return -1;
+    }
+
+    const std::vector<Glyph> &get_glyphs() const { return glyphs_; }
+    int get_baseline() { return baseline_; }
+    int get_height() { return height_; }
+    uint8_t get_bpp() { return bpp_; }
+
+protected:
+    std::vector<Glyph> glyphs_;
+    int baseline_;
+    int height_;
+    uint8_t bpp_;
+};
+
+}  // namespace font
+}  // namespace esphome
@@ -0,0 +1,78 @@
+#pragma once
+// Host stand-in for esphome/components/image/image.h with the same pixel
+// layouts and transparency conventions
+#include "esphome/core/color.h"
+#include "esphome/components/display/display.h"
+
+namespace esphome {
+namespace image {
+
+enum ImageType {
+    IMAGE_TYPE_BINARY = 0,
+    IMAGE_TYPE_GRAYSCALE = 1,
+    IMAGE_TYPE_RGB24 = 2,
+    IMAGE_TYPE_RGB565 = 3,
+    IMAGE_TYPE_RGBA = 4,
+};
+
+class Image {
+public:
+    Image(const uint8_t *data_start, int width, int height, ImageType type)
+        : width_(width), height_(height), type_(type), data_start_(data_start) {}
+
+    Color get_pixel(int x, int y, Color color_on = display::COLOR_ON, Color color_off = display::COLOR_OFF) const {
+        if (x < 0 || x >= width_ || y < 0 || y >= height_) {
+            return color_off;
+        }
+        switch (type_) {
+            case IMAGE_TYPE_BINARY: {
+                const uint32_t width_8 = ((width_ + 7u) / 8u) * 8u;
+                const uint32_t pos = x + y * width_8;
+                return (progmem_read_byte(data_start_ + (pos / 8u)) & (0x80 >> (pos % 8u))) ? color_on : color_off;
+            }
+            case IMAGE_TYPE_GRAYSCALE: {
+                const uint8_t g = progmem_read_byte(data_start_ + x + y * width_);
+                return Color(g, g, g, (g == 1 && transparent_) ? 0 : 0xFF);
+            }
+            case IMAGE_TYPE_RGB24: {
+                const uint32_t pos = (x + y * width_) * 3;
+                const uint8_t r = progmem_read_byte(data_start_ + pos);
+                const uint8_t g = progmem_read_byte(data_start_ + pos + 1);
+                const uint8_t b = progmem_read_byte(data_start_ + pos + 2);
+                return Color(r, g, b, (r == 0 && g == 0 && b == 1 && transparent_) ? 0 : 0xFF);
+            }
+            case IMAGE_TYPE_RGB565: {
+                const uint32_t pos = (x + y * width_) * 2;
+                const uint16_t v = (progmem_read_byte(data_start_ + pos) << 8) | progmem_read_byte(data_start_ + pos + 1);
+                const uint8_t r = (v & 0xF800) >> 11;
+                const uint8_t g = (v & 0x07E0) >> 5;
+                const uint8_t b = v & 0x001F;
+                return Color((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2),
+                             (v == 0x0020 && transparent_) ? 0 : 0xFF);
+            }
+            case IMAGE_TYPE_RGBA: {
+                const uint32_t pos = (x + y * width_) * 4;
+                return Color(progmem_read_byte(data_start_ + pos), progmem_read_byte(data_start_ + pos + 1),
+                             progmem_read_byte(data_start_ + pos + 2), progmem_read_byte(data_start_ + pos + 3));
+            }
+        }
+        return color_off;
+    }
+
+    int get_width() const { return width_; }
+    int get_height() const { return height_; }
+    const uint8_t *get_data_start() const { return data_start_; }
+    ImageType get_type() const { return type_; }
+    void set_transparency(bool transparent) { transparent_ = transparent; }
+    bool has_transparency() const { return transparent_; }
+
+protected:
+    int width_;
+    int height_;
+    ImageType type_;
+    const uint8_t *data_start_;
+    bool transparent_{false};
+};
+
+}  // namespace image
+}  // namespace esphome
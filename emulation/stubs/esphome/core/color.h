@@ -0,0 +1,38 @@
+#pragma once
+// Host stand-in for esphome/core/color.h
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+
+struct Color {
+    union {
+        struct {
+            union {
+                uint8_t r;
+                uint8_t red;
+            };
+            union {
+                uint8_t g;
+                uint8_t green;
+            };
+            union {
+                uint8_t b;
+                uint8_t blue;
+            };
+            union {
+                uint8_t w;
+                uint8_t white;
+            };
+        };
+        uint32_t raw_32;
+    };
+
+    constexpr Color() : raw_32(0) {}
+    constexpr Color(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b), w(0) {}
+    constexpr Color(uint8_t r, uint8_t g, uint8_t b, uint8_t w) : r(r), g(g), b(b), w(w) {}
+
+    bool operator==(const Color &o) const { return raw_32 == o.raw_32; }
+    bool operator!=(const Color &o) const { return raw_32 != o.raw_32; }
+};
+
+}  // namespace esphome
@@ -0,0 +1,19 @@
+#pragma once
+// Host stand-in for the parts of esphome/core/helpers.h used by the elements
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "esphome/core/optional.h"
+
+#define ESPHOME_ALWAYS_INLINE __attribute__((always_inline))
+#define HOT
+#define PROGMEM
+
+namespace esphome {
+
+static const float PI = 3.141592653589793f;
+
+inline uint8_t progmem_read_byte(const uint8_t *addr) { return *addr; }
+
+}  // namespace esphome
@@ -0,0 +1,11 @@
+#pragma once
+// Host stand-in for esphome/core/optional.h
+#include <optional>
+
+namespace esphome {
+
+template<typename T>
+using optional = std::optional<T>;
+using std::nullopt;
+
+}  // namespace esphome
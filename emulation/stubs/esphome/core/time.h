@@ -0,0 +1,16 @@
+#pragma once
+// Host stand-in for esphome/core/time.h
+#include <cstddef>
+#include <ctime>
+
+namespace esphome {
+
+struct ESPTime {
+    struct tm t {};
+
+    size_t strftime(char *buffer, size_t buffer_len, const char *format) {
+        return ::strftime(buffer, buffer_len, format, &t);
+    }
+};
+
+}  // namespace esphome
@@ -4,6 +4,13 @@
 #include "esphome/core/application.h"
 #include "esphome/core/helpers.h"
 #include <algorithm>
+#ifdef USE_ESP8266
+#include <Esp.h>
+#endif
+#ifdef USE_ESP32
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#endif
 
 
 
@@ -12,6 +19,18 @@ namespace waveshare_epaper {
 
 static const char *TAG = "waveshare_epaper";
 
+#ifdef USE_ESP32
+// Preferences live in NVS on the ESP32, a flash write per refresh. RTC slow
+// memory survives deep sleep too and is cleared on power-on.
+struct RtcShownFrame {
+    uint32_t checksum;
+    uint32_t fingerprint;
+    uint32_t build;
+    bool valid;
+};
+static RTC_DATA_ATTR RtcShownFrame rtc_shown_frame = {0, 0, 0, false};
+#endif
+
 
 void WaveshareEPaper::setup_pins_() {
     // this->init_internal_(this->get_buffer_length_());
@@ -28,6 +47,16 @@ void WaveshareEPaper::setup_pins_() {
     
     this->reset_();
 }
+WaveshareEPaper::HeapInfo WaveshareEPaper::heap_info_() {
+#if defined(USE_ESP8266)
+    return {ESP.getFreeHeap(), ESP.getMaxFreeBlockSize()};
+#elif defined(USE_ESP32)
+    return {uint32_t(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)),
+            uint32_t(heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL))};
+#else
+    return {0, 0};
+#endif
+}
 float WaveshareEPaper::get_setup_priority() const { return setup_priority::PROCESSOR; }
 void WaveshareEPaper::command(uint8_t value) {
     this->start_command_();
@@ -39,25 +68,134 @@ void WaveshareEPaper::data(uint8_t value) {
     this->write_byte(value);
     this->end_data_();
 }
-bool WaveshareEPaper::wait_until_idle_() {
-    if (this->busy_pin_ == nullptr) {
-        return true;
+void WaveshareEPaper::start_busy_wait_(BusyWait what) {
+    this->busy_wait_ = what;
+    this->busy_start_ = millis();
+}
+uint32_t WaveshareEPaper::busy_timeout_(BusyWait what) const {
+    switch (what) {
+        case BusyWait::PowerOn:
+            return this->power_on_timeout_ms_;
+        case BusyWait::Refresh:
+            return this->refresh_timeout_ms_;
+        case BusyWait::PowerOff:
+            return this->power_off_timeout_ms_;
+        default:
+            return 0;
     }
-    
-    const uint32_t start = millis();
-    while (this->busy_pin_->digital_read()) {
-        if (millis() - start > 1000) {
-            ESP_LOGE(TAG, "Timeout while displaying image!");
-            return false;
+}
+void WaveshareEPaper::poll_busy_() {
+    const auto what = this->busy_wait_;
+    const uint32_t elapsed = millis() - this->busy_start_;
+    const uint32_t timeout = this->busy_timeout_(what);
+    if (this->busy_pin_ == nullptr) {
+        if (elapsed < timeout) {
+            return;
         }
-        delay(10);
+    } else if (this->busy_pin_->digital_read()) {
+        if (elapsed < timeout) {
+            return;
+        }
+        ESP_LOGE(TAG, "Timeout while waiting for the panel (%u ms)", unsigned(elapsed));
     }
-    return true;
+    ESP_LOGD(TAG, "Panel idle after %u ms", unsigned(elapsed));
+    this->busy_ms_ = elapsed;
+    this->busy_wait_ = BusyWait::None;
+    this->on_idle_(what);
+}
+void WaveshareEPaper::on_idle_(BusyWait what) {
+    if (what == BusyWait::Refresh) {
+        this->commit_shown_();
+        this->refresh_complete_callback_.call();
+    }
+}
+// What is shown is kept in RTC memory, never in flash. Other platforms only
+// remember it until the next reboot.
+void WaveshareEPaper::restore_shown_() {
+#if defined(USE_ESP8266)
+    // not in flash: RTC user memory
+    this->shown_pref_ = global_preferences->make_preference<ShownFrame>(fnv1_hash("waveshare_epaper_frame"), false);
+    this->shown_valid_ = this->shown_pref_.load(&this->shown_);
+#elif defined(USE_ESP32)
+    this->shown_ = ShownFrame{rtc_shown_frame.checksum, rtc_shown_frame.fingerprint, rtc_shown_frame.build};
+    this->shown_valid_ = rtc_shown_frame.valid;
+#endif
+    // RTC memory survives resets and OTA updates, not only deep sleep
+    if (this->shown_valid_ && this->shown_.build != build_id_()) {
+        ESP_LOGD(TAG, "Shown frame is from another firmware build, drawing it again");
+        this->shown_valid_ = false;
+    }
+}
+uint32_t WaveshareEPaper::build_id_() {
+    return fnv1_hash(App.get_compilation_time());
+}
+void WaveshareEPaper::commit_shown_() {
+    this->shown_.checksum = this->frame_checksum_;
+    this->shown_.fingerprint = this->frame_fingerprint_;
+    this->shown_.build = build_id_();
+    this->shown_valid_ = true;
+#if defined(USE_ESP8266)
+    this->shown_pref_.save(&this->shown_);
+#elif defined(USE_ESP32)
+    rtc_shown_frame = RtcShownFrame{this->shown_.checksum, this->shown_.fingerprint, this->shown_.build, true};
+#endif
+}
+void WaveshareEPaper::refresh_() {
+    if (this->shown_valid_ && this->frame_checksum_ == this->shown_.checksum) {
+        ++this->refresh_skips_;
+        ESP_LOGD(TAG, "Frame unchanged (checksum 0x%08X), refresh skipped (%u so far)",
+                 unsigned(this->frame_checksum_), unsigned(this->refresh_skips_));
+        // same pixels, remember the new fingerprint for next time
+        this->commit_shown_();
+        this->refresh_complete_callback_.call();
+        return;
+    }
+    // COMMAND DISPLAY REFRESH
+    ESP_LOGW(TAG, "COMMAND DISPLAY REFRESH");
+    this->command(0x12);
+    this->start_busy_wait_(BusyWait::Refresh);
 }
 void WaveshareEPaper::update() {
     if (ready_to_update){
+        if (this->busy_wait_ != BusyWait::None){
+            // commands sent while the panel is busy are lost
+            this->update_deferred_ = true;
+            return;
+        }
+        if (this->frame_pending_){
+            ESP_LOGD(TAG, "Frame still being sent, restarting it");
+            this->frame_pending_ = false;
+        }
+        this->heap_before_ = heap_info_();
+        const uint32_t writer_start = elements::cycleCount();
         this->do_update_();
+        this->writer_cycles_ = elements::cycleCount() - writer_start;
+        this->heap_after_ = heap_info_();
+        const uint32_t fingerprint = this->scene_fingerprint_();
+        if (this->shown_valid_ && fingerprint == this->shown_.fingerprint) {
+            ++this->render_skips_;
+            ESP_LOGD(TAG, "Scene unchanged (fingerprint 0x%08X), render skipped (%u so far)",
+                     unsigned(fingerprint), unsigned(this->render_skips_));
+            this->refresh_complete_callback_.call();
+            return;
+        }
+        this->frame_fingerprint_ = fingerprint;
         this->display();
+        this->frame_pending_ = true;
+    }
+}
+void WaveshareEPaper::loop() {
+    if (this->busy_wait_ != BusyWait::None){
+        this->poll_busy_();
+        return;
+    }
+    if (this->update_deferred_){
+        this->update_deferred_ = false;
+        this->update();
+        return;
+    }
+    if (this->frame_pending_){
+        this->frame_pending_ = this->display_slice_(this->render_budget_ms_);
     }
 }
 
@@ -71,7 +209,22 @@ void WaveshareEPaper::start_data_() {
     this->enable();
 }
 void WaveshareEPaper::end_data_() { this->disable(); }
-void WaveshareEPaper::on_safe_shutdown() { this->deep_sleep(); }
+void WaveshareEPaper::on_safe_shutdown() {
+    // loop() no longer runs, finish the sleep sequence here
+    this->frame_pending_ = false;
+    this->update_deferred_ = false;
+    // let a running refresh complete first: commands sent to a busy panel
+    // are lost, and its on_idle_ records the frame as shown
+    this->wait_idle_();
+    this->deep_sleep();
+    this->wait_idle_();
+}
+void WaveshareEPaper::wait_idle_() {
+    while (this->busy_wait_ != BusyWait::None) {
+        this->poll_busy_();
+        delay(10);
+    }
+}
 
 
 // ========================================================
@@ -107,9 +260,34 @@ void WaveshareEPaper7P5InC::initialize() {
     // COMMAND POWER ON
     ESP_LOGW(TAG, "COMMAND POWER ON");
     this->command(0x04);
-    this->wait_until_idle_();
-    delay(10);
-    
+    this->start_busy_wait_(BusyWait::PowerOn);
+}
+
+void WaveshareEPaper7P5InC::on_idle_(BusyWait what) {
+    switch (what) {
+        case BusyWait::PowerOn:
+            this->initialize_powered_();
+            break;
+        case BusyWait::PowerOff:
+            // COMMAND DEEP SLEEP
+            this->command(0x07);
+            this->data(0xA5);  // check byte
+            break;
+        case BusyWait::Refresh:
+#ifdef USE_SENSOR
+            if (this->busy_time_sensor_ != nullptr) {
+                this->busy_time_sensor_->publish_state(this->busy_ms_);
+            }
+#endif
+            WaveshareEPaper::on_idle_(what);
+            break;
+        default:
+            WaveshareEPaper::on_idle_(what);
+            break;
+    }
+}
+
+void WaveshareEPaper7P5InC::initialize_powered_() {
     // COMMAND PLL CONTROL
     ESP_LOGW(TAG, "COMMAND PLL CONTROL");
     this->command(0x30);
@@ -147,38 +325,143 @@ void WaveshareEPaper7P5InC::initialize() {
     this->data(0x03);
 }
 
-void HOT WaveshareEPaper7P5InC::display() {
+void WaveshareEPaper7P5InC::display() {
+    const uint32_t build_start = elements::cycleCount();
+    const auto stats = elements.finalize();
+    this->build_cycles_ = elements::cycleCount() - build_start;
+    ESP_LOGD(TAG, "Scene: %u elements, removed %u (off-screen %u, occluded %u, merged %u), %u lines drawn as rects",
+             unsigned(stats.total), unsigned(stats.removed()), unsigned(stats.offscreen),
+             unsigned(stats.occluded), unsigned(stats.merged), unsigned(stats.linesAsRects));
+    const auto& arena = elements.memory();
+    ESP_LOGD(TAG, "Arena: %u of %u bytes used, high-water mark %u, %u allocations on the heap",
+             unsigned(arena.usedBytes()), unsigned(arena.capacityBytes()), unsigned(arena.highWaterBytes()),
+             unsigned(arena.overflowCount()));
+    
     // COMMAND DATA START TRANSMISSION 1
+    // Restarts the panel's write position if a previous frame was cut short
     this->command(0x10);
+    this->begin_checksum_();
+    elements.beginRender();
+    this->frame_start_ = millis();
+    this->spi_cycles_ = 0;
     
-    this->start_data_();
-    
-    uint8_t pix2 = 0;
-    bool pi = true;
-    elements.render([this, &pi, &pix2](int x, int y, const elements::Color3& pallettePix){
-        if(x==0){
-            ESP_LOGW(TAG, "Render line %d of %d", y, static_height_());
+    this->scene_memory_ = elements.memoryUsage();
+    this->dither_buffer_bytes_ = elements.rowBufferBytes();
+    const auto& m = this->scene_memory_;
+    char kinds[160];
+    this->format_kinds_(kinds, sizeof(kinds));
+    ESP_LOGD(TAG, "Memory: %u elements (%s) in %u bytes: objects %u, data %u, list %u; dither buffer %u bytes",
+             unsigned(m.count()), kinds, unsigned(m.totalBytes()), unsigned(m.elementBytes), unsigned(m.dataBytes),
+             unsigned(m.listBytes), unsigned(this->dither_buffer_bytes_));
+    ESP_LOGD(TAG, "Heap: %u free, largest block %u before the writer; %u free, largest block %u after",
+             unsigned(this->heap_before_.free), unsigned(this->heap_before_.largest_block),
+             unsigned(this->heap_after_.free), unsigned(this->heap_after_.largest_block));
+    this->publish_memory_();
+}
+
+void WaveshareEPaper7P5InC::format_kinds_(char *buffer, size_t len) const {
+    // "line 3, rect 12, text 4"
+    buffer[0] = '\0';
+    size_t pos = 0;
+    for (size_t k = 0; k < elements::elementKindCount && pos < len; ++k) {
+        const auto kind = elements::ElementKind(k);
+        if (this->scene_memory_.count(kind) > 0) {
+            pos += snprintf(buffer + pos, len - pos, "%s%s %u", pos > 0 ? ", " : "", elements::elementKindName(kind),
+                            unsigned(this->scene_memory_.count(kind)));
         }
-        auto binPix = elements::col2bin(pallettePix);
-        if (pi){
-            pix2 = pix2 | binPix.color;
-        } else {
-            pix2 = pix2 <<4;
-            pix2 = pix2 | binPix.color;
-            this->write_byte(pix2);
+    }
+}
+
+void WaveshareEPaper7P5InC::publish_memory_() {
+#ifdef USE_SENSOR
+    const auto publish = [](sensor::Sensor *s, float value) {
+        if (s != nullptr) {
+            s->publish_state(value);
         }
-        pi = !pi;
+    };
+    publish(this->element_count_sensor_, this->scene_memory_.count());
+    publish(this->display_list_size_sensor_, this->scene_memory_.totalBytes());
+    publish(this->dither_buffer_size_sensor_, this->dither_buffer_bytes_);
+    publish(this->free_heap_before_sensor_, this->heap_before_.free);
+    publish(this->free_heap_after_sensor_, this->heap_after_.free);
+    publish(this->largest_free_block_before_sensor_, this->heap_before_.largest_block);
+    publish(this->largest_free_block_after_sensor_, this->heap_after_.largest_block);
+#endif
+}
+
+bool HOT WaveshareEPaper7P5InC::display_slice_(uint32_t budget_ms) {
+    const uint32_t start = millis();
+    bool more;
+    // CS is held only for the duration of a slice, DC is set again on resume
+    this->start_data_();
+    do {
+        more = elements.renderNextRow([this](int x, int, const elements::PaletteColor& pallettePix){
+            // two pixels per byte, left one in the high nibble
+            auto& pix2 = this->row_buffer_[x / 2];
+            if (x % 2 == 0){
+                pix2 = pallettePix.code.color << 4;
+            } else {
+                pix2 |= pallettePix.code.color;
+            }
+        });
+        const uint32_t spi_start = elements::cycleCount();
+        this->write_array(this->row_buffer_, sizeof(this->row_buffer_));
+        this->spi_cycles_ += elements::cycleCount() - spi_start;
+        this->add_checksum_(this->row_buffer_, sizeof(this->row_buffer_));
+        ESP_LOGV(TAG, "Sent line %d of %d", elements.renderedRows(), static_height_());
         App.feed_wdt();
-    });
-    App.feed_wdt();
-    
-    
+    } while (more && millis() - start < budget_ms);
     this->end_data_();
     
-    // COMMAND DISPLAY REFRESH
-    ESP_LOGW(TAG, "COMMAND DISPLAY REFRESH");
-    this->command(0x12);
-    // this->wait_until_idle_();
+    if (more){
+        return true;
+    }
+    this->publish_profile_();
+    this->refresh_();
+    return false;
+}
+
+void WaveshareEPaper7P5InC::publish_profile_() {
+    const auto& p = elements.profile();
+    const float per_ms = elements::cyclesPerMicrosecond() * 1000.0f;
+    const float writer_ms = this->writer_cycles_ / per_ms;
+    const float build_ms = this->build_cycles_ / per_ms;
+    const float raster_ms = p.rasterCycles / per_ms;
+    const float dither_ms = p.ditherCycles / per_ms;
+    const float spi_ms = this->spi_cycles_ / per_ms;
+    ESP_LOGD(TAG, "Frame sent in %u ms: writer %.1f ms, build %.1f ms, raster %.1f ms, dither %.1f ms, SPI %.1f ms",
+             unsigned(millis() - this->frame_start_), writer_ms, build_ms, raster_ms, dither_ms, spi_ms);
+    ESP_LOGD(TAG, "Glyph cache %u hits / %u misses, image cache %u hits / %u misses",
+             unsigned(elements.glyphs().hitCount()), unsigned(elements.glyphs().missCount()),
+             unsigned(elements.images().hitCount()), unsigned(elements.images().missCount()));
+#ifdef EPAPER_PROFILE
+    constexpr int pixels = static_width_() * static_height_();
+    ESP_LOGD(TAG, "Elements: %.2f visited per pixel", p.visitsPerPixel(pixels));
+    for (size_t k = 0; k < elements::elementKindCount; ++k) {
+        const auto& kp = p.kinds[k];
+        if (kp.visits == 0) {
+            continue;
+        }
+        ESP_LOGD(TAG, "  %s: %.2f ms, %u row visits, %.3f per pixel",
+                 elements::elementKindName(elements::ElementKind(k)), kp.cycles / per_ms, unsigned(kp.visits),
+                 float(kp.covered) / pixels);
+    }
+#endif
+#ifdef USE_SENSOR
+    const auto publish = [](sensor::Sensor *s, float value) {
+        if (s != nullptr) {
+            s->publish_state(value);
+        }
+    };
+    publish(this->writer_time_sensor_, writer_ms);
+    publish(this->build_time_sensor_, build_ms);
+    publish(this->raster_time_sensor_, raster_ms);
+    publish(this->dither_time_sensor_, dither_ms);
+    publish(this->spi_time_sensor_, spi_ms);
+#ifdef EPAPER_PROFILE
+    publish(this->visits_per_pixel_sensor_, p.visitsPerPixel(pixels));
+#endif
+#endif
 }
 
 void WaveshareEPaper7P5InC::fill(Color color) {
@@ -186,6 +469,13 @@ void WaveshareEPaper7P5InC::fill(Color color) {
     elements.fill(elements::Color3{color});
 }
 
+void WaveshareEPaper7P5InC::set_palette(uint32_t black, uint32_t white, uint32_t ink){
+    auto rgb = [](uint32_t c){
+        return elements::Color3((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF);
+    };
+    elements.palette.set(rgb(black), rgb(white), rgb(ink));
+}
+
 void WaveshareEPaper7P5InC::clear(){
     elements.clear();
 }
@@ -201,6 +491,51 @@ void WaveshareEPaper7P5InC::dump_config() {
     LOG_PIN("  Reset Pin: ", this->reset_pin_);
     LOG_PIN("  DC Pin: ", this->dc_pin_);
     LOG_PIN("  Busy Pin: ", this->busy_pin_);
+    ESP_LOGCONFIG(TAG, "  Render Budget: %u ms", unsigned(this->render_budget_ms_));
+    ESP_LOGCONFIG(TAG, "  Arena Size: %u bytes", unsigned(elements.memory().capacityBytes()));
+#ifdef EPAPER_PROFILE
+    ESP_LOGCONFIG(TAG, "  Profiling: per element type");
+#endif
+    ESP_LOGCONFIG(TAG, "  Skipped: %u renders, %u refreshes", unsigned(this->render_skips_),
+                  unsigned(this->refresh_skips_));
+    ESP_LOGCONFIG(TAG, "  Busy Timeouts: power on %u ms, refresh %u ms, power off %u ms",
+                  unsigned(this->power_on_timeout_ms_), unsigned(this->refresh_timeout_ms_),
+                  unsigned(this->power_off_timeout_ms_));
+    if (this->busy_pin_ == nullptr) {
+        ESP_LOGCONFIG(TAG, "  No busy pin: every wait lasts its whole timeout");
+    }
+    for(uint8_t i=0; i < 3; ++i){
+        const auto& c = elements.palette[i];
+        ESP_LOGCONFIG(TAG, "  Palette %u: #%02X%02X%02X (code 0x%X)", i, c.color.red, c.color.green, c.color.blue, c.code.color);
+    }
+    if (this->dither_buffer_bytes_ > 0) {
+        char kinds[160];
+        this->format_kinds_(kinds, sizeof(kinds));
+        ESP_LOGCONFIG(TAG, "  Last Frame: %u elements (%s), display list %u bytes, dither buffer %u bytes",
+                      unsigned(this->scene_memory_.count()), kinds, unsigned(this->scene_memory_.totalBytes()),
+                      unsigned(this->dither_buffer_bytes_));
+        ESP_LOGCONFIG(TAG, "  Heap Around Writer: %u/%u free/largest block before, %u/%u after",
+                      unsigned(this->heap_before_.free), unsigned(this->heap_before_.largest_block),
+                      unsigned(this->heap_after_.free), unsigned(this->heap_after_.largest_block));
+    }
+#ifdef USE_SENSOR
+    LOG_SENSOR("  ", "Element Count", this->element_count_sensor_);
+    LOG_SENSOR("  ", "Display List Size", this->display_list_size_sensor_);
+    LOG_SENSOR("  ", "Dither Buffer Size", this->dither_buffer_size_sensor_);
+    LOG_SENSOR("  ", "Free Heap Before", this->free_heap_before_sensor_);
+    LOG_SENSOR("  ", "Free Heap After", this->free_heap_after_sensor_);
+    LOG_SENSOR("  ", "Largest Free Block Before", this->largest_free_block_before_sensor_);
+    LOG_SENSOR("  ", "Largest Free Block After", this->largest_free_block_after_sensor_);
+    LOG_SENSOR("  ", "Writer Time", this->writer_time_sensor_);
+    LOG_SENSOR("  ", "Build Time", this->build_time_sensor_);
+    LOG_SENSOR("  ", "Raster Time", this->raster_time_sensor_);
+    LOG_SENSOR("  ", "Dither Time", this->dither_time_sensor_);
+    LOG_SENSOR("  ", "SPI Time", this->spi_time_sensor_);
+    LOG_SENSOR("  ", "Busy Time", this->busy_time_sensor_);
+#ifdef EPAPER_PROFILE
+    LOG_SENSOR("  ", "Visits Per Pixel", this->visits_per_pixel_sensor_);
+#endif
+#endif
     LOG_UPDATE_INTERVAL(this);
 }
 
@@ -1,8 +1,18 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
+#include "esphome/core/automation.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/display/display.h"
 #include "esphome/components/spi/spi.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#ifdef USE_QR_CODE
+#include "esphome/components/qr_code/qr_code.h"
+#endif
 #include "elements.hpp"
 
 namespace esphome {
@@ -28,10 +38,15 @@ public:
     virtual void deep_sleep() = 0;
 
     void update() override;
+    void loop() override;
+
+    // Upper bound on time spent sending rows per loop() call
+    void set_render_budget(uint32_t ms){ render_budget_ms_ = ms; }
 
     void setup() override {
         ready_to_update = false;
         this->setup_pins_();
+        this->restore_shown_();
         this->initialize();
     }
 
@@ -41,13 +56,68 @@ public:
         ready_to_update = r;
     }
 
+    // Longest time the busy pin may stay asserted after each command. Without
+    // a busy pin every wait lasts exactly this long.
+    void set_power_on_timeout(uint32_t ms) { power_on_timeout_ms_ = ms; }
+    void set_refresh_timeout(uint32_t ms) { refresh_timeout_ms_ = ms; }
+    void set_power_off_timeout(uint32_t ms) { power_off_timeout_ms_ = ms; }
+
+    void add_on_refresh_complete_callback(std::function<void()> &&callback) {
+        this->refresh_complete_callback_.add(std::move(callback));
+    }
+
+    // Frames that matched the one on the panel and were not refreshed
+    uint32_t get_refresh_skips() const { return refresh_skips_; }
+    // Updates whose scene fingerprint matched the frame on the panel, they
+    // were neither rendered nor sent
+    uint32_t get_render_skips() const { return render_skips_; }
+
 protected:
     // void draw_absolute_pixel_internal(int x, int y, int color) override;
 
-    bool wait_until_idle_();
+    // Commands the panel stays busy after, polled from loop()
+    enum class BusyWait : uint8_t {
+        None,
+        PowerOn,
+        Refresh,
+        PowerOff,
+    };
+
+    void start_busy_wait_(BusyWait what);
+    void poll_busy_();
+    // Polls until no wait is pending, for when loop() no longer runs
+    void wait_idle_();
+    uint32_t busy_timeout_(BusyWait what) const;
+    // Continues the command sequence once the panel is idle again
+    virtual void on_idle_(BusyWait what);
+
+    // FNV-1a over every byte streamed for the current frame. A frame whose
+    // checksum matches the last refreshed one is not refreshed again. The
+    // checksum and scene fingerprint of the frame on the panel are kept in
+    // RTC memory so this holds across deep sleep.
+    void restore_shown_();
+    void commit_shown_();
+    static uint32_t build_id_();
+    void begin_checksum_() { frame_checksum_ = 2166136261UL; }
+    void add_checksum_(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            frame_checksum_ = (frame_checksum_ ^ data[i]) * 16777619UL;
+        }
+    }
+    // Sends DISPLAY REFRESH unless the frame is already on the panel
+    void refresh_();
+    // Structural hash of the scene the writer just built
+    virtual uint32_t scene_fingerprint_() = 0;
 
     void setup_pins_();
 
+    struct HeapInfo {
+        uint32_t free;
+        uint32_t largest_block;
+    };
+    // Zero on platforms without heap statistics
+    static HeapInfo heap_info_();
+
     void reset_() {
         if (this->reset_pin_ != nullptr) {
         this->reset_pin_->digital_write(false);
@@ -64,11 +134,57 @@ protected:
     void start_data_();
     void end_data_();
 
+    // Sends rows of the frame started by display() until the budget is
+    // spent, returns whether rows are left
+    virtual bool display_slice_(uint32_t budget_ms) { return false; }
+
     GPIOPin *reset_pin_{nullptr};
     GPIOPin *dc_pin_;
     GPIOPin *busy_pin_{nullptr};
     
     bool ready_to_update;
+    bool frame_pending_{false};
+    bool update_deferred_{false};
+    uint32_t render_budget_ms_{20};
+
+    BusyWait busy_wait_{BusyWait::None};
+    uint32_t busy_start_{0};
+    uint32_t power_on_timeout_ms_{1000};
+    uint32_t refresh_timeout_ms_{180000};
+    uint32_t power_off_timeout_ms_{1000};
+    CallbackManager<void()> refresh_complete_callback_;
+
+    // build identifies the firmware that drew the frame: fingerprints
+    // describe the scene, not how it is rendered, so after an update that
+    // changes rendering an unchanged scene must be drawn again
+    struct ShownFrame {
+        uint32_t checksum;
+        uint32_t fingerprint;
+        uint32_t build;
+    };
+    uint32_t frame_checksum_{0};
+    uint32_t frame_fingerprint_{0};
+    ShownFrame shown_{0, 0, 0};
+    bool shown_valid_{false};
+    uint32_t refresh_skips_{0};
+    uint32_t render_skips_{0};
+#ifdef USE_ESP8266
+    ESPPreferenceObject shown_pref_;
+#endif
+
+    // Heap around the last run of the writer lambda
+    HeapInfo heap_before_{0, 0};
+    HeapInfo heap_after_{0, 0};
+    // Cycles the writer lambda took, and how long the last wait lasted
+    uint32_t writer_cycles_{0};
+    uint32_t busy_ms_{0};
+};
+
+class RefreshCompleteTrigger : public Trigger<> {
+public:
+    explicit RefreshCompleteTrigger(WaveshareEPaper *parent) {
+        parent->add_on_refresh_complete_callback([this]() { this->trigger(); });
+    }
 };
 
 
@@ -95,12 +211,9 @@ public:
     void dump_config() override;
 
     void deep_sleep() override {
-        // COMMAND POWER OFF
+        // COMMAND POWER OFF, deep sleep follows once the panel is idle
         this->command(0x02);
-        this->wait_until_idle_();
-        // COMMAND DEEP SLEEP
-        this->command(0x07);
-        this->data(0xA5);  // check byte
+        this->start_busy_wait_(BusyWait::PowerOff);
     }
 
     display::DisplayType get_display_type() override { return display::DisplayType::DISPLAY_TYPE_COLOR; }
@@ -114,6 +227,39 @@ public:
     void fill(Color color) override;
     void clear();
     
+    // Panel inks as 0xRRGGBB and the nearest-ink lookup table generated by display.py
+    void set_palette(uint32_t black, uint32_t white, uint32_t ink);
+    void set_palette_lut(const uint8_t *lut) { elements.palette.setLut(lut); }
+    void set_dither_mode(elements::DitherMode mode) { elements.set_dither_mode(mode); }
+    void set_arena_size(size_t bytes) { elements.set_arena_capacity(bytes); }
+
+#ifdef USE_SENSOR
+    // Memory metrics, published with every rendered frame
+    void set_element_count_sensor(sensor::Sensor *s) { element_count_sensor_ = s; }
+    void set_display_list_size_sensor(sensor::Sensor *s) { display_list_size_sensor_ = s; }
+    void set_dither_buffer_size_sensor(sensor::Sensor *s) { dither_buffer_size_sensor_ = s; }
+    void set_free_heap_before_sensor(sensor::Sensor *s) { free_heap_before_sensor_ = s; }
+    void set_free_heap_after_sensor(sensor::Sensor *s) { free_heap_after_sensor_ = s; }
+    void set_largest_free_block_before_sensor(sensor::Sensor *s) { largest_free_block_before_sensor_ = s; }
+    void set_largest_free_block_after_sensor(sensor::Sensor *s) { largest_free_block_after_sensor_ = s; }
+    // Stage timings in ms, published once per frame; busy time once the
+    // refresh completed
+    void set_writer_time_sensor(sensor::Sensor *s) { writer_time_sensor_ = s; }
+    void set_build_time_sensor(sensor::Sensor *s) { build_time_sensor_ = s; }
+    void set_raster_time_sensor(sensor::Sensor *s) { raster_time_sensor_ = s; }
+    void set_dither_time_sensor(sensor::Sensor *s) { dither_time_sensor_ = s; }
+    void set_spi_time_sensor(sensor::Sensor *s) { spi_time_sensor_ = s; }
+    void set_busy_time_sensor(sensor::Sensor *s) { busy_time_sensor_ = s; }
+#ifdef EPAPER_PROFILE
+    void set_visits_per_pixel_sensor(sensor::Sensor *s) { visits_per_pixel_sensor_ = s; }
+#endif
+#endif
+    
+    // Elements drawn while disabled snap to the nearest ink, e.g. text over gradients
+    void set_dithering(bool enabled){
+        this->elements.set_dithering(enabled);
+    }
+    
     inline void draw_pixel_at(int x, int y){
         this->elements.draw_pixel_at(x, y);
     }
@@ -274,13 +420,62 @@ public:
     void image(int x, int y, image::Image *image, display::ImageAlign align, Color color_on = display::COLOR_ON, Color color_off = display::COLOR_OFF){
         this->elements.image(x, y, image, align, color_on, color_off);
     }
+
+    void image(int x, int y, const elements::PaletteImage *image, display::ImageAlign align = display::ImageAlign::TOP_LEFT){
+        this->elements.image(x, y, image, align);
+    }
+
+#ifdef USE_QR_CODE
+    // The modules arrive through draw_pixel_at and end up as pixel runs
+    void qr_code(int x, int y, qr_code::QrCode *qr_code, Color color_on = display::COLOR_ON, int scale = 1){
+        qr_code->draw(this, x, y, color_on, scale);
+    }
+#endif  // USE_QR_CODE
     
     elements::Elements<detail::WaveshareEPaper7P5InCProps> elements;
 protected:
+    bool display_slice_(uint32_t budget_ms) override;
+    uint32_t scene_fingerprint_() override { return elements.fingerprint(); }
+    void on_idle_(BusyWait what) override;
+    // Rest of initialize() once POWER ON completed
+    void initialize_powered_();
+    // Comma separated element counts of the last frame
+    void format_kinds_(char *buffer, size_t len) const;
+    void publish_memory_();
+    // Logs and publishes where the time of the frame just sent went
+    void publish_profile_();
+
     uint32_t get_buffer_length_() override;
     int get_width_internal() override;
     int get_height_internal() override;
 
+    // Packed panel codes of the row being sent, two pixels per byte
+    uint8_t row_buffer_[static_width_() / 2];
+    uint32_t frame_start_{0};
+    uint32_t build_cycles_{0};
+    uint64_t spi_cycles_{0};
+
+    // Display list of the last rendered frame
+    elements::SceneMemory scene_memory_;
+    size_t dither_buffer_bytes_{0};
+#ifdef USE_SENSOR
+    sensor::Sensor *element_count_sensor_{nullptr};
+    sensor::Sensor *display_list_size_sensor_{nullptr};
+    sensor::Sensor *dither_buffer_size_sensor_{nullptr};
+    sensor::Sensor *free_heap_before_sensor_{nullptr};
+    sensor::Sensor *free_heap_after_sensor_{nullptr};
+    sensor::Sensor *largest_free_block_before_sensor_{nullptr};
+    sensor::Sensor *largest_free_block_after_sensor_{nullptr};
+    sensor::Sensor *writer_time_sensor_{nullptr};
+    sensor::Sensor *build_time_sensor_{nullptr};
+    sensor::Sensor *raster_time_sensor_{nullptr};
+    sensor::Sensor *dither_time_sensor_{nullptr};
+    sensor::Sensor *spi_time_sensor_{nullptr};
+    sensor::Sensor *busy_time_sensor_{nullptr};
+#ifdef EPAPER_PROFILE
+    sensor::Sensor *visits_per_pixel_sensor_{nullptr};
+#endif
+#endif
 };
 
 
@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <new>
 #include <utility>
 
 namespace tpimpl {
@@ -28,6 +29,16 @@ struct FunctionDestructorStruct {
     };
 };
 
+// Destroys an object constructed with placement new, memory is not freed
+template <typename Type>
+struct FunctionDestroyStruct {
+    using FT = void (*)(void *);
+    using OFT = void (*)(void *);
+    constexpr static inline OFT FP = [](void *ptr) {
+        reinterpret_cast<Type *>(ptr)->~Type();
+    };
+};
+
 /// Create a single trait function table per class
 template <typename Type, typename Trait, typename Table, typename... FuncS>
 struct FunctionTableInstance {
@@ -61,6 +72,7 @@ struct FunctionTableInstance {
     class name {                                                               \
         struct FunctionTable {                                                 \
             void (*destructor)(void *ptr);                                     \
+            void (*destroy)(void *ptr);                                        \
             TABLE                                                              \
         };                                                                     \
         tpimpl::FunctionMemberDummy *_p = nullptr;                             \
@@ -72,6 +84,7 @@ struct FunctionTableInstance {
             name,                                                               \
             FunctionTable,                                                      \
             tpimpl::FunctionDestructorStruct<T>,                                \
+            tpimpl::FunctionDestroyStruct<T>,                                   \
             CONSTRUCTOR>;                                                       \
     public:                                                                    \
         name() = default;                                                      \
@@ -98,14 +111,26 @@ struct FunctionTableInstance {
         return reinterpret_cast<const T *>(d._p);                                \
     }                                                                           \
     class name##_Owning : public name {                                        \
+        /* constructed in memory owned by someone else, e.g. an arena */      \
+        bool _placed = false;                                                  \
+        void release() {                                                       \
+            if (_p) {                                                          \
+                if (_placed) {                                                 \
+                    _ftable->destroy(_p);                                      \
+                } else {                                                       \
+                    _ftable->destructor(_p);                                   \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
     public:                                                                    \
         template <typename T>                                                  \
-        name##_Owning(T *p)                                                    \
-            : name{p} {}                                                       \
+        name##_Owning(T *p, bool placed = false)                               \
+            : name{p}, _placed(placed) {}                                      \
                                                                                \
         name##_Owning(name##_Owning &&other) {                                 \
             _p = other._p;                                                     \
             _ftable = other._ftable;                                           \
+            _placed = other._placed;                                           \
             other._p = nullptr;                                                \
             other._ftable = nullptr;                                           \
         }                                                                      \
@@ -113,22 +138,31 @@ struct FunctionTableInstance {
         name##_Owning(const name##_Owning &other) = delete;                    \
                                                                                \
         name##_Owning &operator=(name##_Owning &&other) {                      \
-            _p = other._p;                                                     \
-            other._p = nullptr;                                                \
+            if (this != &other) {                                              \
+                release();                                                     \
+                _p = other._p;                                                 \
+                _ftable = other._ftable;                                       \
+                _placed = other._placed;                                       \
+                other._p = nullptr;                                            \
+                other._ftable = nullptr;                                       \
+            }                                                                  \
             return *this;                                                      \
         }                                                                      \
                                                                                \
         name##_Owning &operator=(const name##_Owning &other) = delete;         \
                                                                                \
         ~name##_Owning() {                                                     \
-            if (_p) {                                                          \
-                _ftable->destructor(_p);                                       \
-            }                                                                  \
+            release();                                                         \
         }                                                                       \
     };                                                                          \
     template<typename T, typename... Args>                                      \
     name##_Owning make##name(Args... args){                                     \
         return {new T{std::forward<Args>(args)...}};                            \
+    }                                                                           \
+    /* constructs T in mem, which must outlive the returned object */          \
+    template<typename T, typename... Args>                                      \
+    name##_Owning place##name(void *mem, Args... args){                         \
+        return {new (mem) T{std::forward<Args>(args)...}, true};                \
     }
 
 #define TRAIT_EXPAND(...) __VA_ARGS__
@@ -166,3 +200,32 @@ struct FunctionTableInstance {
                 TRAIT_CONSTRUCTOR_FUNCTION f4),                                 \
     TRAIT_FUNCTION_DEFINITION f1 TRAIT_FUNCTION_DEFINITION f2                   \
     TRAIT_FUNCTION_DEFINITION f3 TRAIT_FUNCTION_DEFINITION f4)
+
+#define Trait5(name, f1, f2, f3, f4, f5)                                        \
+    TRAIT_INTERNAL(name, TRAIT_FTABLE_FUNCTION f1; TRAIT_FTABLE_FUNCTION f2;    \
+                    TRAIT_FTABLE_FUNCTION f3; TRAIT_FTABLE_FUNCTION f4;         \
+                    TRAIT_FTABLE_FUNCTION f5;                                   \
+    ,                                                                           \
+    TRAIT_EXPAND(TRAIT_CONSTRUCTOR_FUNCTION f1,                                 \
+                TRAIT_CONSTRUCTOR_FUNCTION f2,                                  \
+                TRAIT_CONSTRUCTOR_FUNCTION f3,                                  \
+                TRAIT_CONSTRUCTOR_FUNCTION f4,                                  \
+                TRAIT_CONSTRUCTOR_FUNCTION f5),                                 \
+    TRAIT_FUNCTION_DEFINITION f1 TRAIT_FUNCTION_DEFINITION f2                   \
+    TRAIT_FUNCTION_DEFINITION f3 TRAIT_FUNCTION_DEFINITION f4                   \
+    TRAIT_FUNCTION_DEFINITION f5)
+
+#define Trait6(name, f1, f2, f3, f4, f5, f6)                                    \
+    TRAIT_INTERNAL(name, TRAIT_FTABLE_FUNCTION f1; TRAIT_FTABLE_FUNCTION f2;    \
+                    TRAIT_FTABLE_FUNCTION f3; TRAIT_FTABLE_FUNCTION f4;         \
+                    TRAIT_FTABLE_FUNCTION f5; TRAIT_FTABLE_FUNCTION f6;         \
+    ,                                                                           \
+    TRAIT_EXPAND(TRAIT_CONSTRUCTOR_FUNCTION f1,                                 \
+                TRAIT_CONSTRUCTOR_FUNCTION f2,                                  \
+                TRAIT_CONSTRUCTOR_FUNCTION f3,                                  \
+                TRAIT_CONSTRUCTOR_FUNCTION f4,                                  \
+                TRAIT_CONSTRUCTOR_FUNCTION f5,                                  \
+                TRAIT_CONSTRUCTOR_FUNCTION f6),                                 \
+    TRAIT_FUNCTION_DEFINITION f1 TRAIT_FUNCTION_DEFINITION f2                   \
+    TRAIT_FUNCTION_DEFINITION f3 TRAIT_FUNCTION_DEFINITION f4                   \
+    TRAIT_FUNCTION_DEFINITION f5 TRAIT_FUNCTION_DEFINITION f6)